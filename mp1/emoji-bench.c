@@ -0,0 +1,294 @@
+/*
+ * Throughput benchmark for the emoji library.
+ *
+ * Generates a synthetic corpus of ASCII text with emoji sequences mixed in
+ * and a dictionary of translations, then times `emoji_count`,
+ * `emoji_invertAll` and `replace` over the corpus.  Each is run a few times
+ * untimed (warmup) and then timed over several repetitions; the report gives
+ * the mean, spread and range of the throughput in MB/s, as a table or (with
+ * -J) as JSON.
+ *
+ * The corpus is shaped by:
+ * - the density: the chance that each character is an emoji sequence,
+ * - the sequence length: the most emoji in one sequence, joined by ZWJs (so
+ *   a length of 1 gives lone emoji),
+ * - the skin tones: the chance that each emoji has one, and
+ * - the dictionary size: how many sequences have a translation; half the
+ *   sequences in the corpus are drawn from the dictionary.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "emoji.h"
+#include "emoji-translate.h"
+
+#define DEFAULT_MEGABYTES 16
+#define DEFAULT_DENSITY 0.05
+#define DEFAULT_SEQUENCE 1
+#define DEFAULT_TONES 0.125
+#define DEFAULT_DICTIONARY 1000
+#define DEFAULT_WARMUP 2
+#define DEFAULT_REPETITIONS 10
+#define MAX_SEQUENCE 16
+#define MAX_ENCODED (MAX_SEQUENCE * 11)   // An emoji, a skin tone and a ZWJ each.
+
+typedef struct {
+  size_t bytes;
+  double density;
+  int sequence;
+  double tones;
+  int dictionary;
+  int warmup;
+  int repetitions;
+  unsigned int seed;
+  int json;
+} options_t;
+
+typedef struct {
+  const char *name;
+  double mean;
+  double stddev;
+  double min;
+  double max;
+} result_t;
+
+static unsigned long long rng;
+
+// xorshift64*, so a seed always gives the same corpus:
+static unsigned int nextRandom() {
+  rng ^= rng >> 12;
+  rng ^= rng << 25;
+  rng ^= rng >> 27;
+  return (unsigned int)((rng * 2685821657736338717ULL) >> 32);
+}
+
+static double nextUniform() {
+  return nextRandom() / 4294967296.0;
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static size_t encode(unsigned char *out, unsigned int codePoint) {
+  out[0] = 0xF0 | (codePoint >> 18);
+  out[1] = 0x80 | ((codePoint >> 12) & 0x3F);
+  out[2] = 0x80 | ((codePoint >> 6) & 0x3F);
+  out[3] = 0x80 | (codePoint & 0x3F);
+  return 4;
+}
+
+/*
+ * Writes a random emoji sequence of 1 to `maxLength` emoji from U+1F300..U+1F64F
+ * to `out` (NUL-terminated), each with a skin tone at the chance `tones`,
+ * returning its length in bytes.  The skin tones, which only extend an emoji,
+ * and U+1F53E..U+1F545, which a ZWJ cannot join, are not drawn as emoji, so
+ * each sequence is one grapheme cluster and emoji_count should count each once.
+ */
+static size_t randomSequence(unsigned char *out, int maxLength, double tones) {
+  int length = 1 + nextRandom() % maxLength;
+  size_t len = 0;
+  for (int e = 0; e < length; e++) {
+    if (e > 0) {
+      memcpy(out + len, "\xE2\x80\x8D", 3);  // ZWJ
+      len += 3;
+    }
+    unsigned int codePoint;
+    do {
+      codePoint = 0x1F300 + nextRandom() % 0x350;
+    } while ((codePoint >= 0x1F3FB && codePoint <= 0x1F3FF) || (codePoint >= 0x1F53E && codePoint <= 0x1F545));
+    len += encode(out + len, codePoint);
+    if (nextUniform() < tones) {
+      len += encode(out + len, 0x1F3FB + nextRandom() % 5);  // A skin tone.
+    }
+  }
+  out[len] = '\0';
+  return len;
+}
+
+// Fills `emoji` with `options->dictionary` random sequences, returning the sources (in its arena).
+static unsigned char **makeDictionary(emoji_t *emoji, const options_t *options) {
+  unsigned char **sources = (unsigned char **) malloc(options->dictionary * sizeof(unsigned char *));
+  unsigned char sequence[MAX_ENCODED + 1];
+  char translation[32];
+  for (int k = 0; k < options->dictionary; k++) {
+    randomSequence(sequence, options->sequence, options->tones);
+    snprintf(translation, sizeof(translation), "<word %d>", k);
+    emoji_add_translation(emoji, sequence, (const unsigned char *) translation);
+  }
+  for (unsigned int k = 0; k < emoji->count; k++) {
+    sources[k] = emoji->source[k];
+  }
+  return sources;
+}
+
+// Returns a corpus of `options->bytes` bytes (NUL-terminated), counting its emoji sequences in `*sequences`.
+static unsigned char *makeCorpus(const options_t *options, unsigned char **sources, unsigned int sourceCount,
+                                 size_t *sequences) {
+  static const char letters[] = "etaoinshrdlu etaoinshrdlu cmfwypvbgkjqxz,.";
+  unsigned char *corpus = (unsigned char *) malloc(options->bytes + 1);
+  unsigned char sequence[MAX_ENCODED + 1];
+  size_t len = 0;
+  *sequences = 0;
+
+  while (len < options->bytes) {
+    if (nextUniform() < options->density) {
+      const unsigned char *piece = sequence;
+      size_t pieceLen;
+      if (sourceCount > 0 && nextRandom() % 2 == 0) {
+        piece = sources[nextRandom() % sourceCount];
+        pieceLen = strlen((const char *) piece);
+      } else {
+        pieceLen = randomSequence(sequence, options->sequence, options->tones);
+      }
+      if (len + pieceLen > options->bytes) {
+        break;
+      }
+      memcpy(corpus + len, piece, pieceLen);
+      len += pieceLen;
+      (*sequences)++;
+    } else {
+      corpus[len++] = (nextRandom() % 64 == 0) ? '\n' : letters[nextRandom() % (sizeof(letters) - 1)];
+    }
+  }
+  while (len < options->bytes) {
+    corpus[len++] = ' ';
+  }
+  corpus[len] = '\0';
+  return corpus;
+}
+
+
+enum { OP_COUNT, OP_INVERT, OP_REPLACE };
+
+/*
+ * Runs `op` on a fresh copy of the corpus `options->warmup` times untimed and
+ * `options->repetitions` times timed, and summarizes the throughput.  `*check`
+ * is set to the count or the length of the translation, as a sanity check.
+ */
+static result_t measure(const char *name, int op, const options_t *options, const unsigned char *corpus,
+                        unsigned char *work, emoji_t *emoji, long *check) {
+  result_t result = { name, 0, 0, 0, 0 };
+  double *speeds = (double *) malloc(options->repetitions * sizeof(double));
+
+  for (int run = 0; run < options->warmup + options->repetitions; run++) {
+    memcpy(work, corpus, options->bytes + 1);
+    double start = now();
+    if (op == OP_COUNT) {
+      *check = emoji_count((char *) work);
+    } else if (op == OP_INVERT) {
+      emoji_invertAll((char *) work);
+    } else {
+      unsigned char *translated = replace(emoji, work);
+      *check = (long) strlen((const char *) translated);
+      free(translated);
+    }
+    double elapsed = now() - start;
+    if (run >= options->warmup) {
+      speeds[run - options->warmup] = options->bytes / 1e6 / elapsed;
+    }
+  }
+
+  result.min = result.max = speeds[0];
+  for (int r = 0; r < options->repetitions; r++) {
+    result.mean += speeds[r] / options->repetitions;
+    if (speeds[r] < result.min) { result.min = speeds[r]; }
+    if (speeds[r] > result.max) { result.max = speeds[r]; }
+  }
+  for (int r = 0; r < options->repetitions; r++) {
+    result.stddev += (speeds[r] - result.mean) * (speeds[r] - result.mean);
+  }
+  result.stddev = options->repetitions > 1 ? sqrt(result.stddev / (options->repetitions - 1)) : 0.0;
+  free(speeds);
+  return result;
+}
+
+
+static void usage(const char *prog) {
+  printf("Usage: %s [-m megabytes] [-d density] [-l sequence] [-t tones] [-k dictionary] [-w warmup] [-r repetitions] [-s seed] [-J]\n", prog);
+  printf("  -m  corpus size in MB (default %d)\n", DEFAULT_MEGABYTES);
+  printf("  -d  chance that a character is an emoji sequence, 0..1 (default %.2f)\n", DEFAULT_DENSITY);
+  printf("  -l  most emoji per sequence, joined by ZWJ, 1..%d (default %d)\n", MAX_SEQUENCE, DEFAULT_SEQUENCE);
+  printf("  -t  chance that an emoji has a skin tone, 0..1 (default %.3f)\n", DEFAULT_TONES);
+  printf("  -k  number of translations in the dictionary (default %d)\n", DEFAULT_DICTIONARY);
+  printf("  -w  untimed runs before timing (default %d)\n", DEFAULT_WARMUP);
+  printf("  -r  timed runs (default %d)\n", DEFAULT_REPETITIONS);
+  printf("  -s  random seed (default 340)\n");
+  printf("  -J  print JSON instead of a table\n");
+}
+
+int main(int argc, char **argv) {
+  options_t options = { (size_t) DEFAULT_MEGABYTES * 1000000, DEFAULT_DENSITY, DEFAULT_SEQUENCE, DEFAULT_TONES,
+                        DEFAULT_DICTIONARY, DEFAULT_WARMUP, DEFAULT_REPETITIONS, 340, 0 };
+  int opt;
+  while ((opt = getopt(argc, argv, "m:d:l:t:k:w:r:s:Jh")) != -1) {
+    switch (opt) {
+      case 'm': options.bytes = (size_t) (atof(optarg) * 1e6); break;
+      case 'd': options.density = atof(optarg); break;
+      case 'l': options.sequence = atoi(optarg); break;
+      case 't': options.tones = atof(optarg); break;
+      case 'k': options.dictionary = atoi(optarg); break;
+      case 'w': options.warmup = atoi(optarg); break;
+      case 'r': options.repetitions = atoi(optarg); break;
+      case 's': options.seed = (unsigned int) strtoul(optarg, NULL, 10); break;
+      case 'J': options.json = 1; break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (options.bytes == 0 || options.density < 0 || options.density > 1 || options.sequence < 1 ||
+      options.sequence > MAX_SEQUENCE || options.tones < 0 || options.tones > 1 || options.dictionary < 0 || options.warmup < 0 || options.repetitions < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  rng = 0x9E3779B97F4A7C15ULL ^ options.seed;
+
+  emoji_t emoji;
+  emoji_init(&emoji);
+  unsigned char **sources = makeDictionary(&emoji, &options);
+  size_t sequences;
+  unsigned char *corpus = makeCorpus(&options, sources, emoji.count, &sequences);
+  unsigned char *work = (unsigned char *) malloc(options.bytes + 1);
+
+  long checks[3] = { 0, 0, 0 };
+  result_t results[3];
+  results[0] = measure("emoji_count", OP_COUNT, &options, corpus, work, &emoji, &checks[0]);
+  results[1] = measure("emoji_invertAll", OP_INVERT, &options, corpus, work, &emoji, &checks[1]);
+  results[2] = measure("replace", OP_REPLACE, &options, corpus, work, &emoji, &checks[2]);
+
+  if (options.json) {
+    printf("{\n");
+    printf("  \"corpus\": { \"bytes\": %zu, \"density\": %g, \"sequence\": %d, \"tones\": %g, "
+           "\"dictionary\": %u, \"seed\": %u, \"sequences\": %zu, \"emoji_count\": %ld },\n",
+           options.bytes, options.density, options.sequence, options.tones, emoji.count, options.seed, sequences, checks[0]);
+    printf("  \"warmup\": %d,\n  \"repetitions\": %d,\n  \"results\": [\n", options.warmup, options.repetitions);
+    for (int i = 0; i < 3; i++) {
+      printf("    { \"name\": \"%s\", \"mb_per_s\": { \"mean\": %.1f, \"stddev\": %.1f, \"min\": %.1f, \"max\": %.1f } }%s\n",
+             results[i].name, results[i].mean, results[i].stddev, results[i].min, results[i].max, i < 2 ? "," : "");
+    }
+    printf("  ]\n}\n");
+  } else {
+    printf("corpus: %.1f MB, density %g, up to %d emoji per sequence, tones %g, %u translations, seed %u\n",
+           options.bytes / 1e6, options.density, options.sequence, options.tones, emoji.count, options.seed);
+    printf("        %zu sequences, %ld counted by emoji_count\n\n", sequences, checks[0]);
+    printf("%-16s %14s %14s %14s\n", "function", "MB/s", "min MB/s", "max MB/s");
+    for (int i = 0; i < 3; i++) {
+      printf("%-16s %7.1f ±%5.1f %14.1f %14.1f\n", results[i].name, results[i].mean, results[i].stddev,
+             results[i].min, results[i].max);
+    }
+  }
+
+  free(work);
+  free(corpus);
+  free(sources);
+  emoji_destroy(&emoji);
+  return 0;
+}
@@ -1,103 +1,621 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "emoji.h"
 #include "emoji-translate.h"
+#include "utf8.h"
+#include "grapheme.h"
+#include "fileio.h"
+
+
+/*
+ * The sources are compiled into a byte-level trie as they are added.  Nodes
+ * are numbered from 0 (the root), and the edges of every node live in one
+ * open-addressing hash table keyed on (node, byte), so a step costs one
+ * lookup no matter how many sources share a prefix.
+ */
+typedef struct _emoji_trie_t {
+    unsigned int *match;          // Per node: 1 + index of the source ending here, or 0.
+    unsigned int nodeCount;
+    unsigned int nodeCapacity;
+    unsigned long long *edgeKey;  // 1 + ((parent << 8) | byte), or 0 if the slot is empty.
+    unsigned int *edgeChild;
+    unsigned int edgeCount;
+    unsigned int edgeCapacity;    // A power of two.
+} emoji_trie_t;
+
+static unsigned int edgeSlot(const emoji_trie_t *trie, unsigned long long key) {
+    unsigned int i = (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (trie->edgeCapacity - 1);
+    while (trie->edgeKey[i] != 0 && trie->edgeKey[i] != key) {
+        i = (i + 1) & (trie->edgeCapacity - 1);
+    }
+    return i;
+}
+
+// Returns the child of `node` along `byte`, or 0 (the root is never a child).
+static unsigned int trieStep(const emoji_trie_t *trie, unsigned int node, unsigned char byte) {
+    if (trie->edgeCapacity == 0) {
+        return 0;
+    }
+    unsigned long long key = 1 + (((unsigned long long)node << 8) | byte);
+    unsigned int i = edgeSlot(trie, key);
+    return trie->edgeKey[i] ? trie->edgeChild[i] : 0;
+}
+
+static void trieGrowEdges(emoji_trie_t *trie) {
+    unsigned long long *oldKey = trie->edgeKey;
+    unsigned int *oldChild = trie->edgeChild;
+    unsigned int oldCapacity = trie->edgeCapacity;
+
+    trie->edgeCapacity = oldCapacity ? oldCapacity * 2 : 64;
+    trie->edgeKey = (unsigned long long *) calloc(trie->edgeCapacity, sizeof(unsigned long long));
+    trie->edgeChild = (unsigned int *) malloc(trie->edgeCapacity * sizeof(unsigned int));
+    for (unsigned int i = 0; i < oldCapacity; i++) {
+        if (oldKey[i]) {
+            unsigned int slot = edgeSlot(trie, oldKey[i]);
+            trie->edgeKey[slot] = oldKey[i];
+            trie->edgeChild[slot] = oldChild[i];
+        }
+    }
+    free(oldKey);
+    free(oldChild);
+}
+
+static unsigned int trieNewNode(emoji_trie_t *trie) {
+    if (trie->nodeCount == trie->nodeCapacity) {
+        trie->nodeCapacity = trie->nodeCapacity ? trie->nodeCapacity * 2 : 64;
+        trie->match = (unsigned int *) realloc(trie->match, trie->nodeCapacity * sizeof(unsigned int));
+    }
+    trie->match[trie->nodeCount] = 0;
+    return trie->nodeCount++;
+}
+
+// Adds `source` as the `index`-th source; the first of several equal sources wins.
+static void trieInsert(emoji_trie_t *trie, const unsigned char *source, unsigned int index) {
+    if (trie->nodeCount == 0) {
+        trieNewNode(trie);
+    }
+    unsigned int node = 0;
+    for (; *source; source++) {
+        unsigned int child = trieStep(trie, node, *source);
+        if (!child) {
+            if ((trie->edgeCount + 1) * 2 > trie->edgeCapacity) {
+                trieGrowEdges(trie);
+            }
+            child = trieNewNode(trie);
+            unsigned long long key = 1 + (((unsigned long long)node << 8) | *source);
+            unsigned int slot = edgeSlot(trie, key);
+            trie->edgeKey[slot] = key;
+            trie->edgeChild[slot] = child;
+            trie->edgeCount++;
+        }
+        node = child;
+    }
+    if (node != 0 && trie->match[node] == 0) {
+        trie->match[node] = index + 1;
+    }
+}
+
+static void trieDestroy(emoji_trie_t *trie) {
+    if (trie) {
+        free(trie->match);
+        free(trie->edgeKey);
+        free(trie->edgeChild);
+        free(trie);
+    }
+}
+
+/*
+ * Finds the longest source that matches a run of whole grapheme clusters
+ * starting at `str[i]`, where `str` is `len` bytes and the first cluster is
+ * `size` bytes.  The run ends at a plain ASCII character, and a source only
+ * matches if it ends at a cluster boundary, so "\xF0\x9F\x91\x8D" (thumbs
+ * up) does not match the start of a thumbs up with a skin tone.  Returns 1 +
+ * the source's index and sets `*end` past the match, or returns 0.
+ */
+static unsigned int longestMatch(const emoji_trie_t *trie, const unsigned char *str, size_t i, size_t size, size_t len, size_t *end) {
+    unsigned int best = 0;
+    unsigned int node = 0;
+    for (;;) {
+        for (size_t next = i + size; i < next; i++) {
+            node = trieStep(trie, node, str[i]);
+            if (!node) {
+                return best;
+            }
+        }
+        if (trie->match[node]) {
+            best = trie->match[node];
+            *end = i;
+        }
+        if (i == len) {
+            return best;
+        }
+        size = grapheme_next(str + i, len - i);
+        if (size == 1 && str[i] < 0x80) {
+            return best;
+        }
+    }
+}
+
+
+/*
+ * A string that grows as it is appended to.  A gathering output instead
+ * records where each piece lies (in the input or the dictionary), for
+ * writev(), and copies nothing.
+ */
+typedef struct _output_t {
+    unsigned char *data;
+    size_t len;
+    size_t capacity;
+    int gather;
+    struct iovec *iov;
+    int iovCount;
+    int iovCapacity;
+} output_t;
+
+static void outputInit(output_t *out, size_t capacity) {
+    memset(out, 0, sizeof(output_t));
+    out->capacity = capacity;
+    out->data = (unsigned char *) malloc(capacity);
+}
+
+static void outputInitGather(output_t *out) {
+    memset(out, 0, sizeof(output_t));
+    out->gather = 1;
+}
+
+static void outputGather(output_t *out, const unsigned char *bytes, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    struct iovec *last = out->iovCount ? &out->iov[out->iovCount - 1] : NULL;
+    if (last && (const unsigned char *) last->iov_base + last->iov_len == bytes) {
+        last->iov_len += len;
+        return;
+    }
+    if (out->iovCount == out->iovCapacity) {
+        out->iovCapacity = out->iovCapacity ? out->iovCapacity * 2 : 64;
+        out->iov = (struct iovec *) realloc(out->iov, out->iovCapacity * sizeof(struct iovec));
+    }
+    out->iov[out->iovCount].iov_base = (void *) bytes;
+    out->iov[out->iovCount].iov_len = len;
+    out->iovCount++;
+}
+
+static void outputAppend(output_t *out, const unsigned char *bytes, size_t len) {
+    if (out->gather) {
+        outputGather(out, bytes, len);
+        return;
+    }
+    if (out->len + len + 1 > out->capacity) {
+        while (out->len + len + 1 > out->capacity) {
+            out->capacity *= 2;
+        }
+        out->data = (unsigned char *) realloc(out->data, out->capacity);
+    }
+    memcpy(out->data + out->len, bytes, len);
+    out->len += len;
+}
+
+
+/*
+ * Every source and translation lives in an arena of large chunks, freed all
+ * at once by emoji_destroy().  A dictionary file loaded in bulk becomes one
+ * chunk itself, and its strings are used where they lie.
+ */
+typedef struct _emoji_arena_t {
+    struct _emoji_arena_t *next;
+    size_t used;
+    size_t size;
+    unsigned char data[];
+} emoji_arena_t;
+
+#define ARENA_CHUNK (64 * 1024)
+
+static emoji_arena_t *arenaChunk(emoji_t *emoji, size_t size) {
+    emoji_arena_t *chunk = (emoji_arena_t *) malloc(sizeof(emoji_arena_t) + size);
+    chunk->next = emoji->arena;
+    chunk->used = 0;
+    chunk->size = size;
+    emoji->arena = chunk;
+    return chunk;
+}
+
+static unsigned char *arenaCopy(emoji_t *emoji, const unsigned char *str) {
+    size_t len = strlen(str) + 1;
+    emoji_arena_t *chunk = emoji->arena;
+    if (!chunk || chunk->size - chunk->used < len) {
+        chunk = arenaChunk(emoji, len > ARENA_CHUNK ? len : ARENA_CHUNK);
+    }
+    unsigned char *copy = chunk->data + chunk->used;
+    memcpy(copy, str, len);
+    chunk->used += len;
+    return copy;
+}
+
+
+static unsigned int hashString(const unsigned char *str) {
+    unsigned int hash = 2166136261u;
+    for (; *str; str++) {
+        hash = (hash ^ *str) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns the slot of `source` in the index, or the empty slot where it belongs.
+static unsigned int indexSlot(const emoji_t *emoji, const unsigned char *source) {
+    unsigned int i = hashString(source) & (emoji->indexCapacity - 1);
+    while (emoji->index[i] != 0 && strcmp(emoji->source[emoji->index[i] - 1], source) != 0) {
+        i = (i + 1) & (emoji->indexCapacity - 1);
+    }
+    return i;
+}
+
+static void indexGrow(emoji_t *emoji) {
+    free(emoji->index);
+    emoji->indexCapacity = emoji->indexCapacity ? emoji->indexCapacity * 2 : 64;
+    emoji->index = (unsigned int *) calloc(emoji->indexCapacity, sizeof(unsigned int));
+    for (unsigned int k = 0; k < emoji->count; k++) {
+        emoji->index[indexSlot(emoji, emoji->source[k])] = k + 1;
+    }
+}
+
+/*
+ * Adds the translation of `source`, both already in the arena.  A source that
+ * is already in the dictionary keeps its first translation.
+ */
+static void addTranslation(emoji_t *emoji, unsigned char *source, unsigned char *translation) {
+    if ((emoji->count + 1) * 2 > emoji->indexCapacity) {
+        indexGrow(emoji);
+    }
+    unsigned int slot = indexSlot(emoji, source);
+    if (emoji->index[slot] != 0) {
+        return;
+    }
+
+    if (emoji->count == emoji->capacity) {
+        emoji->capacity = emoji->capacity ? emoji->capacity * 2 : 16;
+        emoji->source = (unsigned char**) realloc(emoji->source, emoji->capacity * sizeof(unsigned char*));
+        emoji->translation = (unsigned char**) realloc(emoji->translation, emoji->capacity * sizeof(unsigned char*));
+    }
+    emoji->source[emoji->count] = source;
+    emoji->translation[emoji->count] = translation;
+    emoji->index[slot] = ++emoji->count;
+
+    if (!emoji->trie) {
+        emoji->trie = (emoji_trie_t *) calloc(1, sizeof(emoji_trie_t));
+    }
+    trieInsert(emoji->trie, source, emoji->count - 1);
+}
 
 
 void emoji_init(emoji_t *emoji) {
     emoji->count = 0;
+    emoji->capacity = 0;
     emoji->source = NULL;
     emoji->translation = NULL;
+    emoji->index = NULL;
+    emoji->indexCapacity = 0;
+    emoji->arena = NULL;
+    emoji->trie = NULL;
 }
 
 void emoji_add_translation(emoji_t *emoji, const unsigned char *source, const unsigned char *translation) {
-    unsigned char *sour = (unsigned char*) malloc(strlen(source) + 1);
-    unsigned char *tran = (unsigned char*) malloc(strlen(translation) + 1);
-    strcpy(sour, source);
-    strcpy(tran, translation);
-    emoji->count++;
-    emoji->source = (unsigned char**) realloc(emoji->source, emoji->count * sizeof(unsigned char*));
-    emoji->translation = (unsigned char**) realloc(emoji->translation, emoji->count * sizeof(unsigned char*));
-    emoji->source[emoji->count - 1] = sour;
-    emoji->translation[emoji->count - 1] = tran;
-}
-
-// Translates the emojis contained in the file `fileName`.
-const unsigned char *emoji_translate_file_alloc(emoji_t *emoji, const char *fileName) {
+    if (emoji->indexCapacity && emoji->index[indexSlot(emoji, source)] != 0) {
+        return;
+    }
+    addTranslation(emoji, arenaCopy(emoji, source), arenaCopy(emoji, translation));
+}
+
+// Returns the translation of exactly `source`, or NULL if it has none.
+const unsigned char *emoji_lookup(const emoji_t *emoji, const unsigned char *source) {
+    if (emoji->count == 0) {
+        return NULL;
+    }
+    unsigned int k = emoji->index[indexSlot(emoji, source)];
+    return k ? emoji->translation[k - 1] : NULL;
+}
+
+/*
+ * Adds every translation in the file `fileName`, one "<source>\t<translation>"
+ * line each (further columns are ignored, and blank lines skipped).  The file
+ * is read in one piece and parsed in place.  Returns the number of lines
+ * loaded, or -1 if the file cannot be read or has a line without a tab (the
+ * lines before it are kept).
+ */
+int emoji_load_translations(emoji_t *emoji, const char *fileName) {
     FILE *file = fopen(fileName, "r");
+    if (file == NULL) {
+        return -1;
+    }
     fseek(file, 0, SEEK_END);
     long fileSize = ftell(file);
     fseek(file, 0, SEEK_SET);
-    unsigned char *fileContent = (unsigned char *) malloc(fileSize + 1);
-    fread(fileContent, 1, fileSize, file);
-    fileContent[fileSize] = '\0';
+    if (fileSize < 0) {
+        fclose(file);
+        return -1;
+    }
+    emoji_arena_t *chunk = arenaChunk(emoji, fileSize + 1);
+    size_t got = fread(chunk->data, 1, fileSize, file);
     fclose(file);
-    unsigned char *translatedFileContent = replace(emoji, fileContent);
-    free(fileContent);
-    return translatedFileContent;
-}
+    chunk->data[got] = '\0';
+    chunk->used = chunk->size;
 
-unsigned char *replace(emoji_t *emoji, unsigned char *string) {
-    unsigned char *str = (unsigned char *)malloc(strlen(string) + 1);
-    memcpy(str, string, strlen(string));
-    str[strlen(string)] = '\0';
-    for (unsigned int i = 0; i < strlen(str); i++) {
-        int j = i;
-        int count = 0;
-        while (str[j] == 0xF0 && str[j + 1] == 0x9F && (unsigned)(j + 3) < strlen(str)) {
-            j += 4;
-            count++;
-        }
-        int found = 0;
-        while (!found && count > 0) {
-            unsigned char *substring = (unsigned char *)malloc(j - i + 1);
-            memcpy(substring, str + i, j - i);
-            substring[j - i] = '\0';
-            for (unsigned int k = 0; k < emoji->count; k++) {
-                if (strcmp(substring, emoji->source[k]) == 0) {
-                    found = 1;
-                    break;
-                }
+    int loaded = 0;
+    unsigned char *line = chunk->data;
+    while (*line) {
+        unsigned char *eol = (unsigned char *) strchr(line, '\n');
+        unsigned char *next = eol ? eol + 1 : line + strlen(line);
+        if (!eol) {
+            eol = next;
+        }
+        if (eol > line && eol[-1] == '\r') {
+            eol--;
+        }
+        *eol = '\0';
+
+        if (*line) {
+            unsigned char *tab = (unsigned char *) strchr(line, '\t');
+            if (!tab) {
+                return -1;
             }
-            free(substring);
-            if (!found) {
-                j -= 4;
-                count--;
+            *tab = '\0';
+            unsigned char *translation = tab + 1;
+            unsigned char *column = (unsigned char *) strchr(translation, '\t');
+            if (column) {
+                *column = '\0';
             }
+            addTranslation(emoji, line, translation);
+            loaded++;
         }
-        if (found) {
-            unsigned char *substr = (unsigned char *)malloc(j - i + 1);
-            memcpy(substr, str + i, j - i);
-            substr[j - i] = '\0';
-            int k = 0;
-            while (strcmp(substr, emoji->source[k]) != 0) {
-                k++;
-            }
-            unsigned char *translation = (unsigned char *)malloc(strlen(emoji->translation[k]) + 1);
-            memcpy(translation, emoji->translation[k], strlen(emoji->translation[k]));
-            translation[strlen(emoji->translation[k])] = '\0';
-            unsigned char *strr = (unsigned char *)malloc(strlen(str) - (j - i) + strlen(translation) + 1);
-            memcpy(strr, str, i);
-            memcpy(strr + i, translation, strlen(translation));
-            memcpy(strr + i + strlen(translation), str + j, strlen(str) - j);
-            strr[strlen(str) - (j - i) + strlen(translation)] = '\0';
-            free(str);
-            free(substr);
-            str = strr;
-            i += strlen(translation) - 1;
-            free(translation);
+        line = next;
+    }
+    return loaded;
+}
+
+/*
+ * Appends the translation of the `len` bytes at `str` to `out`, trying to
+ * match at each grapheme cluster other than a plain ASCII character.  Runs of
+ * ASCII are skipped up to their last character, which may still start a
+ * cluster (a keycap, say) with what follows.
+ */
+static void translateInto(const emoji_t *emoji, const unsigned char *str, size_t len, output_t *out) {
+    size_t copied = 0;
+    size_t i = 0;
+    while (emoji->trie && i < len) {
+        size_t run = utf8_ascii_run(str + i, len - i);
+        if (run > 1) {
+            i += run - 1;
+        }
+        size_t size = grapheme_next(str + i, len - i);
+        if (size == 1 && str[i] < 0x80) {
+            i++;
+            continue;
+        }
+        size_t end;
+        unsigned int match = longestMatch(emoji->trie, str, i, size, len, &end);
+        if (match) {
+            const unsigned char *translation = emoji->translation[match - 1];
+            outputAppend(out, str + copied, i - copied);
+            outputAppend(out, translation, strlen(translation));
+            copied = i = end;
+        } else {
+            i += size;
+        }
+    }
+    outputAppend(out, str + copied, len - copied);
+}
+
+/*
+ * Returns a copy of `string` with every emoji sequence that has a translation
+ * replaced by it.  At each position the longest matching sequence wins.  The
+ * string is scanned once, and the output is built in one growing buffer.
+ */
+unsigned char *replace(emoji_t *emoji, unsigned char *string) {
+    size_t len = strlen(string);
+    output_t out;
+    outputInit(&out, len + 1);
+    translateInto(emoji, string, len, &out);
+    out.data[out.len] = '\0';
+    return out.data;
+}
+
+// Translates the emojis contained in the file `fileName`, which is mapped read-only rather than copied.
+const unsigned char *emoji_translate_file_alloc(emoji_t *emoji, const char *fileName) {
+    fileio_map_t map;
+    if (fileio_map(&map, fileName, 0) != 0) {
+        return NULL;
+    }
+    output_t out;
+    outputInit(&out, map.len + 1);
+    translateInto(emoji, map.data, map.len, &out);
+    out.data[out.len] = '\0';
+    fileio_unmap(&map);
+    return out.data;
+}
+
+/*
+ * Translates the file `fileName` into `outFd` without copying: the file is
+ * mapped read-only, and the output is written with writev() straight from the
+ * mapping and the dictionary.  Returns 0, or -1 on an I/O error.
+ */
+int emoji_translate_file_fd(const emoji_t *emoji, const char *fileName, int outFd) {
+    fileio_map_t map;
+    if (fileio_map(&map, fileName, 0) != 0) {
+        return -1;
+    }
+    output_t out;
+    outputInitGather(&out);
+    translateInto(emoji, map.data, map.len, &out);
+    int result = fileio_writev(outFd, out.iov, out.iovCount);
+    free(out.iov);
+    fileio_unmap(&map);
+    return result;
+}
+
+
+/*
+ * Parallel translation: the input is cut into chunks of about PARALLEL_CHUNK
+ * bytes, the chunks are translated by a pool of threads that share the
+ * (read-only) emoji_t, and the outputs are joined in order.
+ */
+#define PARALLEL_CHUNK (1024 * 1024)
+
+typedef struct _translate_chunk_t {
+    const unsigned char *str;
+    size_t len;
+    unsigned int owner;   // Which input the chunk is part of.
+    output_t out;
+} translate_chunk_t;
+
+typedef struct _translate_job_t {
+    const emoji_t *emoji;
+    translate_chunk_t *chunks;
+    unsigned int count;
+    unsigned int capacity;
+    unsigned int next;    // The next chunk to translate, claimed atomically.
+} translate_job_t;
+
+/*
+ * Returns the first position from `pos` on where `str` can be cut without
+ * cutting a match: between two ASCII characters other than "\r\n", which is
+ * always a grapheme cluster boundary, and no match spans a plain ASCII
+ * character.
+ */
+static size_t safeCut(const unsigned char *str, size_t pos, size_t len) {
+    for (; pos < len; pos++) {
+        if (str[pos] < 0x80 && str[pos - 1] < 0x80 && !(str[pos - 1] == '\r' && str[pos] == '\n')) {
+            return pos;
+        }
+    }
+    return len;
+}
+
+// Adds the chunks of the `len` bytes at `str` to `job`, as input `owner`.
+static void addChunks(translate_job_t *job, const unsigned char *str, size_t len, unsigned int owner) {
+    size_t start = 0;
+    do {
+        size_t end = (len - start > 2 * PARALLEL_CHUNK) ? safeCut(str, start + PARALLEL_CHUNK, len) : len;
+        if (job->count == job->capacity) {
+            job->capacity = job->capacity ? job->capacity * 2 : 16;
+            job->chunks = (translate_chunk_t *) realloc(job->chunks, job->capacity * sizeof(translate_chunk_t));
+        }
+        translate_chunk_t *chunk = &job->chunks[job->count++];
+        chunk->str = str + start;
+        chunk->len = end - start;
+        chunk->owner = owner;
+        start = end;
+    } while (start < len);
+}
+
+static void *translateWorker(void *ptr) {
+    translate_job_t *job = (translate_job_t *) ptr;
+    for (;;) {
+        unsigned int i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->count) {
+            return NULL;
+        }
+        translate_chunk_t *chunk = &job->chunks[i];
+        outputInit(&chunk->out, chunk->len + 1);
+        translateInto(job->emoji, chunk->str, chunk->len, &chunk->out);
+    }
+}
+
+// Translates every chunk of `job` on `threads` threads (counting this one).
+static void runJob(translate_job_t *job, unsigned int threads) {
+    if (threads > job->count) {
+        threads = job->count;
+    }
+    pthread_t *tids = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    unsigned int started = 0;
+    job->next = 0;
+    for (; started + 1 < threads; started++) {
+        if (pthread_create(&tids[started], NULL, translateWorker, job) != 0) {
+            break;
+        }
+    }
+    translateWorker(job);
+    for (unsigned int t = 0; t < started; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+}
+
+// Joins the outputs of the chunks of input `owner`, which start at `*next`, into one string.
+static unsigned char *joinChunks(translate_job_t *job, unsigned int *next) {
+    translate_chunk_t *first = &job->chunks[*next];
+    output_t out = first->out;
+    for ((*next)++; *next < job->count && job->chunks[*next].owner == first->owner; (*next)++) {
+        output_t *part = &job->chunks[*next].out;
+        outputAppend(&out, part->data, part->len);
+        free(part->data);
+    }
+    out.data[out.len] = '\0';
+    return out.data;
+}
+
+/*
+ * Translates `string` as replace() does, using up to `threads` threads.
+ */
+unsigned char *emoji_translate_parallel_alloc(const emoji_t *emoji, const unsigned char *string, unsigned int threads) {
+    translate_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.emoji = emoji;
+    addChunks(&job, string, strlen(string), 0);
+    runJob(&job, threads ? threads : 1);
+
+    unsigned int next = 0;
+    unsigned char *result = joinChunks(&job, &next);
+    free(job.chunks);
+    return result;
+}
+
+/*
+ * Translates each of the `count` files in `fileNames`, using up to `threads`
+ * threads across all of them.  Returns an array of `count` translations (NULL
+ * for a file that could not be read); free each one and the array.
+ */
+unsigned char **emoji_translate_files_alloc(const emoji_t *emoji, const char **fileNames, unsigned int count, unsigned int threads) {
+    fileio_map_t *maps = (fileio_map_t *) malloc(count * sizeof(fileio_map_t));
+    translate_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.emoji = emoji;
+    for (unsigned int f = 0; f < count; f++) {
+        if (fileio_map(&maps[f], fileNames[f], 0) == 0) {
+            addChunks(&job, maps[f].data, maps[f].len, f);
+        } else {
+            maps[f].data = NULL;
+        }
+    }
+    if (job.count) {
+        runJob(&job, threads ? threads : 1);
+    }
+
+    unsigned char **results = (unsigned char **) calloc(count, sizeof(unsigned char *));
+    for (unsigned int next = 0; next < job.count; ) {
+        unsigned int owner = job.chunks[next].owner;
+        results[owner] = joinChunks(&job, &next);
+    }
+    for (unsigned int f = 0; f < count; f++) {
+        if (maps[f].data) {
+            fileio_unmap(&maps[f]);
         }
     }
-    return str;
+    free(maps);
+    free(job.chunks);
+    return results;
 }
 
 void emoji_destroy(emoji_t *emoji) {
-    for (unsigned int i = 0; i < emoji->count; i++) {
-        free(emoji->source[i]);
-        free(emoji->translation[i]);
+    while (emoji->arena) {
+        emoji_arena_t *next = emoji->arena->next;
+        free(emoji->arena);
+        emoji->arena = next;
     }
     free(emoji->source);
     free(emoji->translation);
+    free(emoji->index);
+    trieDestroy(emoji->trie);
 }
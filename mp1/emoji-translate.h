@@ -6,16 +6,28 @@ extern "C" {
 
 typedef struct _emoji_t {
     unsigned int count;
-    unsigned char **source;
+    unsigned char **source;         // Both point into `arena`.
     unsigned char **translation;
+    unsigned int capacity;          // Slots allocated in `source` and `translation`.
+    unsigned int *index;            // Hash table of 1 + the index of each source (0 if empty).
+    unsigned int indexCapacity;     // A power of two.
+    struct _emoji_arena_t *arena;   // Holds every source and translation.
+    struct _emoji_trie_t *trie;     // The sources, compiled for matching.
 } emoji_t;
 
 void emoji_init(emoji_t *emoji);
 void emoji_add_translation(emoji_t *emoji, const unsigned char *source, const unsigned char *translation);
+int emoji_load_translations(emoji_t *emoji, const char *fileName);
+const unsigned char *emoji_lookup(const emoji_t *emoji, const unsigned char *source);
 const unsigned char *emoji_translate_file_alloc(emoji_t *emoji, const char *fileName);
+int emoji_translate_file_fd(const emoji_t *emoji, const char *fileName, int outFd);
 void emoji_destroy(emoji_t *emoji);
 unsigned char *replace(emoji_t *emoji, unsigned char *string);
 
+// Parallel translation, sharing one (read-only) emoji_t across `threads` threads:
+unsigned char *emoji_translate_parallel_alloc(const emoji_t *emoji, const unsigned char *string, unsigned int threads);
+unsigned char **emoji_translate_files_alloc(const emoji_t *emoji, const char **fileNames, unsigned int count, unsigned int threads);
+
 #ifdef __cplusplus
 }
 #endif
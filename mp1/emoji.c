@@ -1,6 +1,20 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "utf8.h"
+#include "grapheme.h"
+#include "fileio.h"
+
+// Bytes read per step by emoji_invertStream:
+#define EMOJI_STREAM_CHUNK (64 * 1024)
 
 
 // Return your favorite emoji.  Do not allocate new memory.
@@ -10,20 +24,398 @@ char *emoji_favorite() {
 }
 
 
+#define isEmoji(codePoint) ((codePoint) >= 0x1F000 && (codePoint) <= 0x1FAFF)
+
+// Returns 1 if the `len` bytes at `s`, one grapheme cluster, include an emoji code point.
+static int clusterHasEmoji(const unsigned char *s, size_t len) {
+  for (size_t k = 0; k + 4 <= len; k++) {
+    if (s[k] == 0xF0 && s[k + 1] == 0x9F && s[k + 2] >= 0x80 && s[k + 2] <= 0xAB && (s[k + 3] & 0xC0) == 0x80) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Counts the emoji from offset `i` of `s`, a cluster start, a grapheme cluster
+ * at a time, until the cluster that reaches `stop`; `*end` is set to the
+ * cluster boundary where it stopped.  Runs of ASCII are skipped up to their
+ * last character, which may still start a cluster with what follows.
+ */
+static size_t countEmojiScalar(const unsigned char *s, size_t i, size_t stop, size_t len, size_t *end) {
+  size_t count = 0;
+  while (i < stop) {
+    size_t run = utf8_ascii_run(s + i, len - i);
+    if (run > 1) {
+      i += run - 1;
+    }
+    size_t size = grapheme_next(s + i, len - i);
+    count += clusterHasEmoji(s + i, size);
+    i += size;
+  }
+  *end = i;
+  return count;
+}
+
+/*
+ * emoji_count counts grapheme clusters, so a ZWJ sequence, an emoji with a
+ * skin tone and a flag each count once.  The vectorized counters below take
+ * a fast path through text made of ASCII and emoji sequences.  Each step
+ * finds where these start, at every offset:
+ * - an emoji, U+1F000..U+1FAFF: F0 9F [80-AB] [80-BF], leaving out the skin
+ *   tones and the regional indicators (F0 9F 87 [A6-BF], which pair up),
+ * - a skin tone, U+1F3FB..U+1F3FF: F0 9F 8F [BB-BF],
+ * - U+FE0F, which asks for the emoji style: EF B8 8F, and
+ * - a ZWJ, U+200D: E2 80 8D.
+ * If those cover every non-ASCII byte of the step, a cluster starts at each
+ * ASCII character and each emoji, except an emoji that a ZWJ joins to the one
+ * before it (UAX #29's GB11, skin tones and U+FE0F allowed in between); skin
+ * tones, U+FE0F and ZWJs extend the cluster they follow.  The step counts the
+ * emoji that start a cluster.
+ *
+ * Anything else goes to the grapheme segmenter, and so do a skin tone, U+FE0F
+ * or ZWJ after ASCII (which might start a cluster of their own) and a ZWJ next
+ * to an emoji that is not Extended_Pictographic, since GB11 joins those only.
+ * isOddEmoji() marks whole blocks of rarely used symbols as such, and single
+ * code points in the blocks people do use.  Only a step with a ZWJ in it needs
+ * that; the U+FE0F and ZWJ patterns are only checked in a step with one of
+ * their lead bytes.
+ *
+ * What the next step needs to know (the bytes of a character that runs into
+ * it, and whether the character before is ASCII, a ZWJ, or part of a sequence
+ * that a ZWJ can extend) is carried over in the bits past the end of the
+ * step, so each step moves on by its full width.  The segmenter restarts from
+ * the last cluster start the scan saw, taking back what was counted for it.
+ */
+
+typedef struct {
+  size_t base;           // Offset of the last cluster start seen,
+  int baseCounted;       // and whether its cluster was counted.
+  size_t emoji;          // Offset of the last emoji seen.
+  uint64_t covered;      // Bytes of the next step that continue a character.
+  uint64_t afterAscii;   // Characters that follow ASCII or a cluster boundary,
+  uint64_t afterZwj;     // a ZWJ,
+  uint64_t afterPict;    // an emoji (Extended_Pictographic unless it is the last one
+                         // seen), its skin tones and U+FE0F,
+  uint64_t afterJoiner;  // or a ZWJ that follows those.
+} scan_t;
+
+// Returns 1 if the emoji at `s` is U+1F100..U+1F27F, U+1F700..U+1F8FF, U+1F53E..U+1F545,
+// U+1F650..U+1F67F, U+1F900..U+1F90B, U+1F93B or U+1F946, which are not Extended_Pictographic.
+static int isOddEmoji(const unsigned char *s) {
+  unsigned int third = s[2] - 0x80, fourth = s[3];
+  return (third >= 0x04 && third <= 0x09) || (third >= 0x1C && third <= 0x23) ||
+         (third == 0x14 && fourth >= 0xBE) || (third == 0x15 && fourth <= 0x85) ||
+         (third == 0x19 && fourth >= 0x90) || (third == 0x24 && (fourth <= 0x8B || fourth == 0xBB)) ||
+         (third == 0x25 && fourth == 0x86);
+}
+
+// Starts a scan at the cluster boundary `i`.
+static void scanRestart(scan_t *scan, size_t i) {
+  scan->base = i;
+  scan->baseCounted = 0;
+  scan->covered = 0;
+  scan->afterAscii = 1;
+  scan->afterZwj = scan->afterPict = scan->afterJoiner = 0;
+}
+
+// Moves a scan past `width` bytes of ASCII at `i`.
+static void scanAscii(scan_t *scan, size_t i, unsigned int width) {
+  scanRestart(scan, i + width);
+  scan->base = i + width - 1;
+}
+
+/*
+ * Moves a scan past the `width`-byte step at offset `i` of `s`, given the
+ * masks of its non-ASCII bytes and of where emoji, skin tones, U+FE0F and ZWJs
+ * start (bit k for offset i + k), and adds its emoji to `*count`.  If the step
+ * has a ZWJ, `odd` marks its emoji that isOddEmoji(); otherwise it is unused.
+ * Returns 0, leaving both alone, if the step needs the segmenter.
+ */
+__attribute__((always_inline))
+static inline int scanStep(scan_t *scan, const unsigned char *s, size_t i, unsigned int width, uint64_t nonAscii,
+                           uint64_t emoji, uint64_t odd, uint64_t tone, uint64_t vs, uint64_t zwj, size_t *count) {
+  uint64_t four = emoji | tone, three = vs | zwj;
+  uint64_t covered = scan->covered | four | four << 1 | four << 2 | four << 3 | three | three << 1 | three << 2;
+  if (nonAscii & ~covered) {
+    return 0;
+  }
+  uint64_t ascii = ~nonAscii & (((uint64_t)1 << width) - 1);
+  uint64_t afterAscii = scan->afterAscii | ascii << 1;
+  if ((tone | vs | zwj) & afterAscii) {
+    return 0;
+  }
+
+  // Without a ZWJ here, whether the emoji are Extended_Pictographic is left for a later step to check:
+  uint64_t afterPict = scan->afterPict;
+  if (!zwj) {
+    odd = 0;
+  } else if (afterPict && isOddEmoji(s + scan->emoji)) {
+    afterPict = 0;
+  }
+  afterPict |= (emoji & ~odd) << 4;
+  uint64_t next = afterPict;
+  do {
+    next &= tone | vs;
+    next = (next & tone) << 4 | (next & vs) << 3;
+    afterPict |= next;
+  } while (next & (tone | vs));
+  uint64_t afterZwj = scan->afterZwj | zwj << 3;
+  uint64_t afterJoiner = scan->afterJoiner | (zwj & afterPict) << 3;
+  uint64_t joined = emoji & afterZwj;
+  if (joined & (odd | ~afterJoiner)) {
+    return 0;
+  }
+  if (joined && !zwj && isOddEmoji(s + i + __builtin_ctzll(joined))) {
+    return 0;
+  }
+
+  uint64_t starts = ascii | (emoji & ~joined);
+  *count += __builtin_popcountll(emoji & ~joined);
+  if (starts) {
+    unsigned int last = 63 - __builtin_clzll(starts);
+    scan->base = i + last;
+    scan->baseCounted = (emoji >> last) & 1;
+  }
+  if (emoji) {
+    scan->emoji = i + 63 - __builtin_clzll(emoji);
+  }
+  scan->covered = covered >> width;
+  scan->afterAscii = afterAscii >> width;
+  scan->afterZwj = afterZwj >> width;
+  scan->afterPict = afterPict >> width;
+  scan->afterJoiner = afterJoiner >> width;
+  return 1;
+}
+
+#if defined(__SSE2__)
+// Byte range checks, unsigned: (b - lo) <= span, max(b, lo) == b and min(b, hi) == b.
+static inline __m128i inRangeSSE2(__m128i b, char lo, char span) {
+  b = _mm_sub_epi8(b, _mm_set1_epi8(lo));
+  return _mm_cmpeq_epi8(_mm_min_epu8(b, _mm_set1_epi8(span)), b);
+}
+
+static inline __m128i atLeastSSE2(__m128i b, char lo) {
+  return _mm_cmpeq_epi8(_mm_max_epu8(b, _mm_set1_epi8(lo)), b);
+}
+
+static inline __m128i atMostSSE2(__m128i b, char hi) {
+  return _mm_cmpeq_epi8(_mm_min_epu8(b, _mm_set1_epi8(hi)), b);
+}
+
+static inline __m128i isSSE2(__m128i b, char value) {
+  return _mm_cmpeq_epi8(b, _mm_set1_epi8(value));
+}
+
+/*
+ * Counts the emoji in 16-byte steps of `s`, setting `*end` to the cluster
+ * start to go on from.  Each step compares the step's bytes and the three
+ * bytes after each of them (four unaligned loads) against the patterns above,
+ * taking the third byte less 0x80.
+ */
+static size_t countEmojiSSE2(const unsigned char *s, size_t len, size_t *end) {
+  const __m128i first = _mm_set1_epi8((char)0xF0);
+  const __m128i second = _mm_set1_epi8((char)0x9F);
+  const __m128i cont = _mm_set1_epi8((char)0x80);
+  const __m128i contMask = _mm_set1_epi8((char)0xC0);
+  const __m128i thirdSpan = _mm_set1_epi8(0x2B);
+  const __m128i toneThird = _mm_set1_epi8(0x0F);
+  const __m128i toneFourth = _mm_set1_epi8((char)0xBB);
+  const __m128i flagThird = _mm_set1_epi8(0x07);
+  const __m128i flagFourth = _mm_set1_epi8((char)0xA6);
+  const __m128i zwjFirst = _mm_set1_epi8((char)0xE2);
+  const __m128i vsFirst = _mm_set1_epi8((char)0xEF);
+
+  scan_t scan;
+  scanRestart(&scan, 0);
+  size_t count = 0, i = 0;
+  while (i + 16 + 3 <= len) {
+    __m128i b0 = _mm_loadu_si128((const __m128i *)(s + i));
+    unsigned int nonAscii = _mm_movemask_epi8(b0);
+    if (nonAscii == 0) {
+      scanAscii(&scan, i, 16);
+      i += 16;
+      continue;
+    }
+    __m128i b1 = _mm_loadu_si128((const __m128i *)(s + i + 1));
+    __m128i b2 = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)(s + i + 2)), cont);
+    __m128i b3 = _mm_loadu_si128((const __m128i *)(s + i + 3));
+
+    __m128i lead = _mm_and_si128(_mm_cmpeq_epi8(b0, first), _mm_cmpeq_epi8(b1, second));
+    __m128i tail = _mm_and_si128(_mm_cmpeq_epi8(_mm_min_epu8(b2, thirdSpan), b2),
+                                 _mm_cmpeq_epi8(_mm_and_si128(b3, contMask), cont));
+    __m128i is8F = _mm_cmpeq_epi8(b2, toneThird);
+    __m128i tone = _mm_and_si128(_mm_and_si128(lead, tail),
+                                 _mm_and_si128(is8F, _mm_cmpeq_epi8(_mm_max_epu8(b3, toneFourth), b3)));
+    __m128i flag = _mm_and_si128(_mm_cmpeq_epi8(b2, flagThird), _mm_cmpeq_epi8(_mm_max_epu8(b3, flagFourth), b3));
+    __m128i emoji = _mm_andnot_si128(_mm_or_si128(tone, flag), _mm_and_si128(lead, tail));
+
+    unsigned int vs = 0, zwj = 0, odd = 0;
+    __m128i isE2 = _mm_cmpeq_epi8(b0, zwjFirst), isEF = _mm_cmpeq_epi8(b0, vsFirst);
+    if (_mm_movemask_epi8(_mm_or_si128(isE2, isEF))) {
+      vs = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(isEF, _mm_cmpeq_epi8(b1, _mm_set1_epi8((char)0xB8))), is8F));
+      zwj = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(isE2, _mm_cmpeq_epi8(b1, cont)),
+                                            _mm_cmpeq_epi8(b2, _mm_set1_epi8(0x0D))));
+    }
+    unsigned int emojiMask = _mm_movemask_epi8(emoji);
+    if (zwj) {
+      // isOddEmoji() at each emoji:
+      __m128i mask = _mm_or_si128(inRangeSSE2(b2, 0x04, 0x05), inRangeSSE2(b2, 0x1C, 0x07));
+      mask = _mm_or_si128(mask, _mm_and_si128(isSSE2(b2, 0x14), atLeastSSE2(b3, (char)0xBE)));
+      mask = _mm_or_si128(mask, _mm_and_si128(isSSE2(b2, 0x15), atMostSSE2(b3, (char)0x85)));
+      mask = _mm_or_si128(mask, _mm_and_si128(isSSE2(b2, 0x19), atLeastSSE2(b3, (char)0x90)));
+      mask = _mm_or_si128(mask, _mm_and_si128(isSSE2(b2, 0x24), _mm_or_si128(atMostSSE2(b3, (char)0x8B),
+                                                                             isSSE2(b3, (char)0xBB))));
+      mask = _mm_or_si128(mask, _mm_and_si128(isSSE2(b2, 0x25), isSSE2(b3, (char)0x86)));
+      odd = _mm_movemask_epi8(_mm_and_si128(mask, emoji));
+    }
+
+    if (!scanStep(&scan, s, i, 16, nonAscii, emojiMask, odd, _mm_movemask_epi8(tone), vs, zwj, &count)) {
+      count += countEmojiScalar(s, scan.base, i + 16, len, &i) - scan.baseCounted;
+      scanRestart(&scan, i);
+      continue;
+    }
+    i += 16;
+  }
+  *end = scan.base;
+  return count - scan.baseCounted;
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+// The AVX2 versions of the SSE2 helpers and of countEmojiSSE2, in 32-byte steps.
+__attribute__((target("avx2")))
+static inline __m256i inRangeAVX2(__m256i b, char lo, char span) {
+  b = _mm256_sub_epi8(b, _mm256_set1_epi8(lo));
+  return _mm256_cmpeq_epi8(_mm256_min_epu8(b, _mm256_set1_epi8(span)), b);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i atLeastAVX2(__m256i b, char lo) {
+  return _mm256_cmpeq_epi8(_mm256_max_epu8(b, _mm256_set1_epi8(lo)), b);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i atMostAVX2(__m256i b, char hi) {
+  return _mm256_cmpeq_epi8(_mm256_min_epu8(b, _mm256_set1_epi8(hi)), b);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i isAVX2(__m256i b, char value) {
+  return _mm256_cmpeq_epi8(b, _mm256_set1_epi8(value));
+}
+
+__attribute__((target("avx2")))
+static size_t countEmojiAVX2(const unsigned char *s, size_t len, size_t *end) {
+  const __m256i first = _mm256_set1_epi8((char)0xF0);
+  const __m256i second = _mm256_set1_epi8((char)0x9F);
+  const __m256i cont = _mm256_set1_epi8((char)0x80);
+  const __m256i contMask = _mm256_set1_epi8((char)0xC0);
+  const __m256i thirdSpan = _mm256_set1_epi8(0x2B);
+  const __m256i toneThird = _mm256_set1_epi8(0x0F);
+  const __m256i toneFourth = _mm256_set1_epi8((char)0xBB);
+  const __m256i flagThird = _mm256_set1_epi8(0x07);
+  const __m256i flagFourth = _mm256_set1_epi8((char)0xA6);
+  const __m256i zwjFirst = _mm256_set1_epi8((char)0xE2);
+  const __m256i vsFirst = _mm256_set1_epi8((char)0xEF);
+
+  scan_t scan;
+  scanRestart(&scan, 0);
+  size_t count = 0, i = 0;
+  while (i + 32 + 3 <= len) {
+    __m256i b0 = _mm256_loadu_si256((const __m256i *)(s + i));
+    unsigned int nonAscii = (unsigned int)_mm256_movemask_epi8(b0);
+    if (nonAscii == 0) {
+      scanAscii(&scan, i, 32);
+      i += 32;
+      continue;
+    }
+    __m256i b1 = _mm256_loadu_si256((const __m256i *)(s + i + 1));
+    __m256i b2 = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i *)(s + i + 2)), cont);
+    __m256i b3 = _mm256_loadu_si256((const __m256i *)(s + i + 3));
+
+    __m256i lead = _mm256_and_si256(_mm256_cmpeq_epi8(b0, first), _mm256_cmpeq_epi8(b1, second));
+    __m256i tail = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(b2, thirdSpan), b2),
+                                    _mm256_cmpeq_epi8(_mm256_and_si256(b3, contMask), cont));
+    __m256i is8F = _mm256_cmpeq_epi8(b2, toneThird);
+    __m256i tone = _mm256_and_si256(_mm256_and_si256(lead, tail),
+                                    _mm256_and_si256(is8F, _mm256_cmpeq_epi8(_mm256_max_epu8(b3, toneFourth), b3)));
+    __m256i flag = _mm256_and_si256(_mm256_cmpeq_epi8(b2, flagThird), _mm256_cmpeq_epi8(_mm256_max_epu8(b3, flagFourth), b3));
+    __m256i emoji = _mm256_andnot_si256(_mm256_or_si256(tone, flag), _mm256_and_si256(lead, tail));
+
+    unsigned int vs = 0, zwj = 0, odd = 0;
+    __m256i isE2 = _mm256_cmpeq_epi8(b0, zwjFirst), isEF = _mm256_cmpeq_epi8(b0, vsFirst);
+    if (_mm256_movemask_epi8(_mm256_or_si256(isE2, isEF))) {
+      vs = (unsigned int)_mm256_movemask_epi8(
+          _mm256_and_si256(_mm256_and_si256(isEF, _mm256_cmpeq_epi8(b1, _mm256_set1_epi8((char)0xB8))), is8F));
+      zwj = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(isE2, _mm256_cmpeq_epi8(b1, cont)),
+                                                                _mm256_cmpeq_epi8(b2, _mm256_set1_epi8(0x0D))));
+    }
+    unsigned int emojiMask = (unsigned int)_mm256_movemask_epi8(emoji);
+    if (zwj) {
+      __m256i mask = _mm256_or_si256(inRangeAVX2(b2, 0x04, 0x05), inRangeAVX2(b2, 0x1C, 0x07));
+      mask = _mm256_or_si256(mask, _mm256_and_si256(isAVX2(b2, 0x14), atLeastAVX2(b3, (char)0xBE)));
+      mask = _mm256_or_si256(mask, _mm256_and_si256(isAVX2(b2, 0x15), atMostAVX2(b3, (char)0x85)));
+      mask = _mm256_or_si256(mask, _mm256_and_si256(isAVX2(b2, 0x19), atLeastAVX2(b3, (char)0x90)));
+      mask = _mm256_or_si256(mask, _mm256_and_si256(isAVX2(b2, 0x24), _mm256_or_si256(atMostAVX2(b3, (char)0x8B),
+                                                                                      isAVX2(b3, (char)0xBB))));
+      mask = _mm256_or_si256(mask, _mm256_and_si256(isAVX2(b2, 0x25), isAVX2(b3, (char)0x86)));
+      odd = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(mask, emoji));
+    }
+
+    if (!scanStep(&scan, s, i, 32, nonAscii, emojiMask, odd, (unsigned int)_mm256_movemask_epi8(tone), vs, zwj,
+                  &count)) {
+      count += countEmojiScalar(s, scan.base, i + 32, len, &i) - scan.baseCounted;
+      scanRestart(&scan, i);
+      continue;
+    }
+    i += 32;
+  }
+  *end = scan.base;
+  return count - scan.baseCounted;
+}
+#endif
+
+// Counts the emoji in the first `len` bytes of `s`, using the widest vectors the CPU has.
+static size_t countEmoji(const unsigned char *s, size_t len) {
+  size_t count = 0, i = 0;
+#if defined(__x86_64__) && defined(__GNUC__)
+  static int hasAVX2 = -1;
+  if (hasAVX2 < 0) {
+    __builtin_cpu_init();
+    hasAVX2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+  }
+  if (hasAVX2) {
+    count = countEmojiAVX2(s, len, &i);
+  } else {
+    count = countEmojiSSE2(s, len, &i);
+  }
+#elif defined(__SSE2__)
+  count = countEmojiSSE2(s, len, &i);
+#endif
+  return count + countEmojiScalar(s, i, len, len, &i);
+}
+
+
 // Count the number of emoji in the UTF-8 string `utf8str`, returning the count.  You should
 // consider everything in the ranges starting from (and including) U+1F000 up to (and including) U+1FAFF.
+// A grapheme cluster (such as a ZWJ sequence or a flag) with any of them in it counts once.
 int emoji_count(const unsigned char *utf8str) {
-  int count = 0;
-  if (utf8str) {
-    for (unsigned int i = 0; i < strlen(utf8str); i++) {
-      if (utf8str[i] == 0xF0 && utf8str[i + 1] == 0x9F) {
-        if (utf8str[i + 2] >= 0x80 && utf8str[i + 2] <= 0xAB && utf8str[i + 3] >= 0x80 && utf8str[i + 3] <= 0xBF) {
-          count++;
-        }
-        i += 3;
-      }
-    }
+  if (!utf8str) {
+    return 0;
+  }
+  return (int)countEmoji(utf8str, strlen((const char *)utf8str));
+}
+
+// Counts the emoji in the file `fileName`, which is mapped read-only rather
+// than copied.  Returns -1 if the file cannot be read.
+int emoji_count_file(const char *fileName) {
+  fileio_map_t map;
+  if (fileio_map(&map, fileName, 0) != 0) {
+    return -1;
   }
+  int count = (int)countEmoji(map.data, map.len);
+  fileio_unmap(&map);
   return count;
 }
 
@@ -41,31 +433,98 @@ char *emoji_random_alloc() {
 }
 
 
+/*
+ * Inversions are looked up in a table indexed by the code point's offset from
+ * U+1F000, which is the low six bits of each of the last two UTF-8 bytes.
+ * Each entry is the UTF-8 encoding of the inverted emoji, or zero if the
+ * emoji is not inverted, so inverting is one lookup and one 4-byte copy.
+ */
+#define INVERT_TABLE_SIZE 0xB00  // U+1F000..U+1FAFF
+
+static unsigned char invertTable[INVERT_TABLE_SIZE][4];
+static int invertTableReady = 0;
+
+void emoji_invert_reset();
+
+// The inversions emoji_invert_reset() restores:
+static const char *defaultInversions[][2] = {
+  { "😊", "😓" },
+  { "😁", "😔" },
+  { "😍", "😒" },
+  { "😌", "😖" },
+  { "😋", "😞" },
+  { "😝", "😣" },
+};
+
+// Returns the table index of the emoji (or "U+1F...") that is all of the `len` bytes at `s`, or -1.
+static int emojiIndex(const unsigned char *s, size_t len) {
+  size_t size;
+  uint32_t codePoint = len ? utf8_decode(s, len, &size) : UTF8_INVALID;
+  if (isEmoji(codePoint) && size == len) {
+    return (int)(codePoint - 0x1F000);
+  }
+  if (len > 2 && len <= 8 && (s[0] == 'U' || s[0] == 'u') && s[1] == '+') {
+    char hex[8];
+    memcpy(hex, s + 2, len - 2);
+    hex[len - 2] = '\0';
+    char *end;
+    long codePoint = strtol(hex, &end, 16);
+    if (*end == '\0' && codePoint >= 0x1F000 && codePoint < 0x1F000 + INVERT_TABLE_SIZE) {
+      return (int)(codePoint - 0x1F000);
+    }
+  }
+  return -1;
+}
+
+static void setInversion(int from, int to) {
+  invertTable[from][0] = 0xF0;
+  invertTable[from][1] = 0x9F;
+  invertTable[from][2] = 0x80 | (to >> 6);
+  invertTable[from][3] = 0x80 | (to & 0x3F);
+}
+
+static void initInvertTable() {
+  if (!invertTableReady) {
+    emoji_invert_reset();
+  }
+}
+
+// Inverts `codePoint`, encoded at `s`, in place if it is an emoji we invert.
+static void invertEmoji(unsigned char *s, uint32_t codePoint) {
+  if (isEmoji(codePoint)) {
+    const unsigned char *inverted = invertTable[codePoint - 0x1F000];
+    if (inverted[0]) {
+      memcpy(s, inverted, 4);
+    }
+  }
+}
+
+// Inverts every emoji that lies entirely within the first `len` bytes of `s`, in one pass.
+static void invertBuffer(unsigned char *s, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    i += utf8_ascii_run(s + i, len - i);
+    if (i < len) {
+      size_t size;
+      uint32_t codePoint = utf8_decode(s + i, len - i, &size);
+      invertEmoji(s + i, codePoint);
+      i += size;
+    }
+  }
+}
+
+
 // Modify the UTF-8 string `utf8str` to invert the FIRST character (which may be up to 4 bytes)
 // in the string if it the first character is an emoji.  At a minimum:
 // - Invert "😊" U+1F60A ("\xF0\x9F\x98\x8A") into ANY non-smiling face.
 // - Choose at least five more emoji to invert.
 void emoji_invertChar(unsigned char *utf8str) {
-  for (unsigned int i = 0; i < strlen(utf8str); i++) {
-    if (utf8str[i] == 0xF0 && utf8str[i+1] == 0x9F) {
-      if (utf8str[i+2] == 0x98 && utf8str[i+3] == 0x8A) {
-        utf8str[i+3] = 0x93;
-      }
-      else if (utf8str[i+2] == 0x98 && utf8str[i+3] == 0x81) {
-        utf8str[i+3] = 0x94;
-      }
-      else if (utf8str[i+2] == 0x98 && utf8str[i+3] == 0x8D) {
-        utf8str[i+3] = 0x92;
-      }
-      else if (utf8str[i+2] == 0x98 && utf8str[i+3] == 0x8C) {
-        utf8str[i+3] = 0x96;
-      }
-      else if (utf8str[i+2] == 0x98 && utf8str[i+3] == 0x8B) {
-        utf8str[i+3] = 0x9E;
-      }
-      else if (utf8str[i+2] == 0x98 && utf8str[i+3] == 0x9D) {
-        utf8str[i+3] = 0xA3;
-      }
+  initInvertTable();
+  size_t len = strlen((const char *)utf8str);
+  for (size_t i = 0, size; i < len; i += size) {
+    uint32_t codePoint = utf8_decode(utf8str + i, len - i, &size);
+    if (codePoint >= 0x1F000 && codePoint <= 0x1FFFF) {
+      invertEmoji(utf8str + i, codePoint);
       break;
     }
   }
@@ -76,9 +535,8 @@ void emoji_invertChar(unsigned char *utf8str) {
 // `emoji_invertChar` function on each character.
 void emoji_invertAll(unsigned char *utf8str) {
   if (utf8str) {
-    for (unsigned int i = 0; i < strlen(utf8str); i++) {
-      emoji_invertChar(&utf8str[i]);
-    }
+    initInvertTable();
+    invertBuffer(utf8str, strlen((const char *)utf8str));
   }
 }
 
@@ -86,17 +544,121 @@ void emoji_invertAll(unsigned char *utf8str) {
 // Reads the full contents of the file `fileName, inverts all emojis, and
 // returns a newly allocated string with the inverted file's content.
 unsigned char *emoji_invertFile_alloc(const char *fileName) {
+  fileio_map_t map;
+  if (fileio_map(&map, fileName, 0) != 0) {
+    return NULL;
+  }
+  unsigned char *fileContent = (unsigned char *) malloc(map.len + 1);
+  if (fileContent) {
+    memcpy(fileContent, map.data, map.len);
+    fileContent[map.len] = '\0';
+    initInvertTable();
+    invertBuffer(fileContent, map.len);
+  }
+  fileio_unmap(&map);
+  return fileContent;
+}
+
+
+// Reads everything from `inFd`, inverts all emojis, and writes the result to `outFd`.
+int emoji_invertStream(int inFd, int outFd) {
+  // Up to three bytes of a character split by a chunk boundary are carried into the next chunk:
+  unsigned char buffer[EMOJI_STREAM_CHUNK + 3];
+  size_t carry = 0;
+  initInvertTable();
+
+  for (;;) {
+    ssize_t got = read(inFd, buffer + carry, EMOJI_STREAM_CHUNK);
+    if (got < 0) {
+      if (errno == EINTR) { continue; }
+      return -1;
+    }
+    struct iovec out = { buffer, carry + got };
+    if (got == 0) {
+      return fileio_writev(outFd, &out, 1);
+    }
+
+    size_t len = out.iov_len;
+    invertBuffer(buffer, len);
+
+    // Hold back a sequence the next chunk may complete:
+    carry = utf8_incomplete_tail(buffer, len);
+    out.iov_len = len - carry;
+    if (fileio_writev(outFd, &out, 1) != 0) {
+      return -1;
+    }
+    memmove(buffer, buffer + len - carry, carry);
+  }
+}
+
+
+// Inverts all emojis in the file `fileName`, writing the result to `outFd`.
+// The file is mapped copy-on-write, inverted in place (copying only the pages
+// with an emoji to invert), and written out in one writev().
+int emoji_invertFile_fd(const char *fileName, int outFd) {
+  fileio_map_t map;
+  if (fileio_map(&map, fileName, 1) != 0) {
+    return -1;
+  }
+  initInvertTable();
+  invertBuffer(map.data, map.len);
+  struct iovec out = { map.data, map.len };
+  int result = fileio_writev(outFd, &out, 1);
+  fileio_unmap(&map);
+  return result;
+}
+
+
+// Restores the built-in inversions, dropping any that were registered.
+void emoji_invert_reset() {
+  memset(invertTable, 0, sizeof(invertTable));
+  for (size_t i = 0; i < sizeof(defaultInversions) / sizeof(defaultInversions[0]); i++) {
+    const unsigned char *from = (const unsigned char *)defaultInversions[i][0];
+    const unsigned char *to = (const unsigned char *)defaultInversions[i][1];
+    setInversion(emojiIndex(from, 4), emojiIndex(to, 4));
+  }
+  invertTableReady = 1;
+}
+
+
+// Makes inverting emoji `from` produce emoji `to`.  Both are given either as
+// the emoji itself or as "U+1F60A", and must be in U+1F000..U+1FAFF.
+int emoji_invert_register(const char *from, const char *to) {
+  int fromIndex = emojiIndex((const unsigned char *)from, strlen(from));
+  int toIndex = emojiIndex((const unsigned char *)to, strlen(to));
+  if (fromIndex < 0 || toIndex < 0) {
+    return -1;
+  }
+  initInvertTable();
+  setInversion(fromIndex, toIndex);
+  return 0;
+}
+
+
+// Registers every inversion in the file `fileName`: one "<from> <to>" pair per
+// line, as for emoji_invert_register.  Blank lines and lines starting with '#'
+// are skipped.  Returns the number of inversions registered, or -1 if the file
+// cannot be read or has an invalid line (the lines before it are kept).
+int emoji_invert_load(const char *fileName) {
   FILE *file = fopen(fileName, "r");
   if (file == NULL) {
-    return NULL;
+    return -1;
+  }
+
+  int count = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    char *from = strtok(line, " \t\r\n");
+    if (from == NULL || from[0] == '#') {
+      continue;
+    }
+    char *to = strtok(NULL, " \t\r\n");
+    if (to == NULL || strtok(NULL, " \t\r\n") != NULL || emoji_invert_register(from, to) != 0) {
+      count = -1;
+      break;
+    }
+    count++;
   }
-  fseek(file, 0, SEEK_END);
-  long fileSize = ftell(file);
-  fseek(file, 0, SEEK_SET);
-  unsigned char *fileContent = (unsigned char *) malloc(fileSize + 1);
-  fread(fileContent, 1, fileSize, file);
-  fileContent[fileSize] = '\0';
   fclose(file);
-  emoji_invertAll(fileContent);
-  return fileContent;
+  return count;
 }
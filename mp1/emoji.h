@@ -6,12 +6,24 @@ extern "C" {
 
 const char *emoji_favorite();
 int emoji_count(char *utf8str);
+int emoji_count_file(const char *fileName);
 char *emoji_random_alloc();
 
 void emoji_invertChar(char *utf8str);
 void emoji_invertAll(char *utf8str);
 unsigned char *emoji_invertFile_alloc(const char *fileName);
 
+// Invert all emoji from `inFd` into `outFd` in one pass, using constant memory,
+// or from the file `fileName` (mapped, not copied) into `outFd` with one write.
+// Return 0 on success and -1 on an I/O error.
+int emoji_invertStream(int inFd, int outFd);
+int emoji_invertFile_fd(const char *fileName, int outFd);
+
+// Change which emoji are inverted, and into what (see emoji.c for the formats).
+int emoji_invert_register(const char *from, const char *to);
+int emoji_invert_load(const char *fileName);
+void emoji_invert_reset();
+
 
 #ifdef __cplusplus
 }
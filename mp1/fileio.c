@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "fileio.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/*
+ * The emoji file APIs work on whole files in memory.  Mapping a file gives
+ * them its pages straight from the page cache, instead of copying it through
+ * a buffer, and reading ahead sequentially suits their single pass over it.
+ */
+
+// Reads everything left in `fd` into a new heap buffer, for files that cannot be mapped.
+static int readAll(int fd, fileio_map_t *map) {
+  size_t capacity = 4096;
+  map->data = (unsigned char *) malloc(capacity);
+  map->len = 0;
+  map->mapped = 0;
+  while (map->data) {
+    if (map->len == capacity) {
+      capacity *= 2;
+      unsigned char *data = (unsigned char *) realloc(map->data, capacity);
+      if (!data) {
+        break;
+      }
+      map->data = data;
+    }
+    ssize_t got = read(fd, map->data + map->len, capacity - map->len);
+    if (got < 0) {
+      if (errno == EINTR) { continue; }
+      break;
+    }
+    if (got == 0) {
+      return 0;
+    }
+    map->len += got;
+  }
+  free(map->data);
+  return -1;
+}
+
+
+/**
+ * Maps the file `fileName` into `map`: read-only, or if `writable`, as a
+ * private copy-on-write mapping, where a write copies only the page it
+ * touches and never reaches the file.  Files that cannot be mapped (pipes,
+ * empty or /proc files) are read into the heap instead.  Returns 0, or -1 if
+ * the file cannot be opened or read.
+ */
+int fileio_map(fileio_map_t *map, const char *fileName, int writable) {
+  int fd = open(fileName, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *data = mmap(NULL, st.st_size, prot, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      map->data = (unsigned char *) data;
+      map->len = st.st_size;
+      map->mapped = 1;
+      close(fd);
+      return 0;
+    }
+  }
+
+  int result = readAll(fd, map);
+  close(fd);
+  return result;
+}
+
+void fileio_unmap(fileio_map_t *map) {
+  if (map->mapped) {
+    munmap(map->data, map->len);
+  } else {
+    free(map->data);
+  }
+  map->data = NULL;
+  map->len = 0;
+}
+
+
+/**
+ * Writes the `count` buffers of `iov` to `fd`, in order, with one writev()
+ * per IOV_MAX buffers (resuming after a short write).  `iov` is used up in
+ * the process.  Returns 0, or -1 on an I/O error.
+ */
+int fileio_writev(int fd, struct iovec *iov, int count) {
+  while (count > 0) {
+    ssize_t written = writev(fd, iov, count < IOV_MAX ? count : IOV_MAX);
+    if (written < 0) {
+      if (errno == EINTR) { continue; }
+      return -1;
+    }
+    while (count > 0 && (size_t) written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (char *) iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The contents of a file, mapped into memory (or read, if it cannot be mapped).
+typedef struct _fileio_map_t {
+  unsigned char *data;
+  size_t len;
+  int mapped;   // 1 if `data` is a mapping, 0 if it was read into the heap.
+} fileio_map_t;
+
+int fileio_map(fileio_map_t *map, const char *fileName, int writable);
+void fileio_unmap(fileio_map_t *map);
+int fileio_writev(int fd, struct iovec *iov, int count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,51 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "grapheme.h"
+#include "grapheme-table.h"
+#include "utf8.h"
+
+/*
+ * Grapheme clusters (what a reader sees as one character: an emoji with its
+ * skin tone, a ZWJ sequence, a flag, a letter with its accents) are found as
+ * UAX #29 describes, from the tables unicode/grapheme-gen.c generates from
+ * unicode/grapheme-break.txt: two lookups give a code point's class, and one
+ * more gives whether the cluster continues and the DFA's next state.
+ */
+
+static unsigned int graphemeClass(uint32_t codePoint) {
+  if (codePoint > 0x10FFFF) {
+    return GRAPHEME_OTHER;  // A malformed sequence stands alone, like an unassigned code point.
+  }
+  return graphemeStage2[graphemeStage1[codePoint >> GRAPHEME_BLOCK_SHIFT]][codePoint & ((1 << GRAPHEME_BLOCK_SHIFT) - 1)];
+}
+
+
+/**
+ * Returns the length in bytes of the grapheme cluster at the start of the
+ * `len` bytes at `s` (0 if `len` is 0).  A cluster ends at the end of the
+ * bytes, so a cluster cut short there is returned as it is.
+ */
+size_t grapheme_next(const unsigned char *s, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  // The state after one code point is just its class:
+  size_t size;
+  unsigned int state = graphemeClass(utf8_decode(s, len, &size));
+  size_t i = size;
+  while (i < len) {
+    uint32_t codePoint = s[i];
+    size = 1;
+    if (codePoint >= 0x80) {
+      codePoint = utf8_decode(s + i, len - i, &size);
+    }
+    unsigned int next = graphemeTransition[state][graphemeClass(codePoint)];
+    if (next & GRAPHEME_BREAK) {
+      break;
+    }
+    state = next & GRAPHEME_STATE_MASK;
+    i += size;
+  }
+  return i;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+size_t grapheme_next(const unsigned char *s, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
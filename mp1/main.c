@@ -1,11 +1,76 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "emoji.h"
 #include "emoji-translate.h"
 
-int main() {
+static int usage(const char *program) {
+  fprintf(stderr, "Usage: %s translate [-j threads] <dictionary.tsv> <file>...\n", program);
+  return 1;
+}
+
+/*
+ * Translates each file with the dictionary (see `emoji_load_translations`),
+ * writing the translations to stdout in the order the files were given.
+ */
+static int translate(int argc, char **argv) {
+  unsigned int threads = (unsigned int) sysconf(_SC_NPROCESSORS_ONLN);
+  int arg = 2;
+  if (arg + 1 < argc && strcmp(argv[arg], "-j") == 0) {
+    threads = (unsigned int) atoi(argv[arg + 1]);
+    arg += 2;
+  }
+  if (argc - arg < 2) {
+    return usage(argv[0]);
+  }
+
+  emoji_t emoji;
+  emoji_init(&emoji);
+  if (emoji_load_translations(&emoji, argv[arg]) < 0) {
+    fprintf(stderr, "Unable to load the dictionary `%s`.\n", argv[arg]);
+    emoji_destroy(&emoji);
+    return 2;
+  }
+  arg++;
+
+  int result = 0;
+  unsigned int count = argc - arg;
+  if (threads <= 1) {
+    // One file at a time, written straight from the file's mapping:
+    for (unsigned int f = 0; f < count; f++) {
+      if (emoji_translate_file_fd(&emoji, argv[arg + f], STDOUT_FILENO) != 0) {
+        fprintf(stderr, "Unable to translate `%s`.\n", argv[arg + f]);
+        result = 3;
+      }
+    }
+    emoji_destroy(&emoji);
+    return result;
+  }
+
+  unsigned char **translations = emoji_translate_files_alloc(&emoji, (const char **) (argv + arg), count, threads);
+  for (unsigned int f = 0; f < count; f++) {
+    if (translations[f]) {
+      fputs((const char *) translations[f], stdout);
+      free(translations[f]);
+    } else {
+      fprintf(stderr, "Unable to read `%s`.\n", argv[arg + f]);
+      result = 3;
+    }
+  }
+  free(translations);
+  emoji_destroy(&emoji);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "translate") == 0) {
+    return translate(argc, argv);
+  } else if (argc > 1) {
+    return usage(argv[0]);
+  }
+
   // Feel free to delete all of this and use this function in any way you want:
   printf("Currently, `main.c` provides a basic call to your functions.\n");
   printf("- Edit `main.c` to test your functions within the context of `main`.\n");
@@ -13,4 +78,4 @@ int main() {
 
   printf("Your favorite emoji: %s\n", emoji_favorite());  
   return 0;
-}
\ No newline at end of file
+}
@@ -84,6 +84,76 @@ TEST_CASE("`emoji_count` correctly detects UTF-8 emojis, with different UTF-8 by
   free(s);
 }
 
+TEST_CASE("`emoji_count` counts emoji at every offset of a long string", "[weight=3][part=1]") {
+  // Long enough for the vectorized scan; each emoji lands at a different offset
+  // within a 16/32-byte step, and the string ends with a truncated emoji.
+  const int total = 200;
+  char *s = (char *) malloc(total * 8 + 8);
+  char *p = s;
+  for (int i = 0; i < total; i++) {
+    for (int pad = 0; pad < i % 5; pad++) { *p++ = 'a'; }
+    memcpy(p, "\xF0\x9F\x98\x8A", 4);
+    p += 4;
+    if (i % 7 == 0) { memcpy(p, "\xF0\x9F\xAC", 3); p += 3; }  // U+1FB00 is past the range.
+  }
+  memcpy(p, "\xF0\x9F\x98", 4);
+  int r = emoji_count(s);
+  REQUIRE(r == total);
+  free(s);
+}
+
+TEST_CASE("`emoji_count` counts each emoji sequence once", "[weight=3][part=1]") {
+  // A ZWJ family, a thumbs up with a skin tone, two flags, a shamrock (outside the range) and a lone skin tone:
+  const char *piece = "\xF0\x9F\x91\xA8\xE2\x80\x8D\xF0\x9F\x91\xA9\xE2\x80\x8D\xF0\x9F\x91\xA7 "
+                      "\xF0\x9F\x91\x8D\xF0\x9F\x8F\xBD "
+                      "\xF0\x9F\x87\xBA\xF0\x9F\x87\xB8\xF0\x9F\x87\xA8\xF0\x9F\x87\xA6"
+                      "\xE2\x98\x98\xEF\xB8\x8F x\xF0\x9F\x8F\xBF";
+  REQUIRE(emoji_count(piece) == 5);
+
+  // Long enough for the vectorized scan, with each sequence at different offsets within a step:
+  const int total = 100;
+  size_t pieceLen = strlen(piece);
+  char *s = (char *) malloc(total * (pieceLen + 40) + 1);
+  char *p = s;
+  for (int i = 0; i < total; i++) {
+    for (int pad = 0; pad < i % 37; pad++) { *p++ = (pad % 3) ? 'a' : ' '; }
+    memcpy(p, piece, pieceLen);
+    p += pieceLen;
+    memcpy(p, "\xF0\x9F\x98\x8A\xF0\x9F\x98\x8A", 8);  // Two more lone emoji.
+    p += 8;
+  }
+  *p = '\0';
+  int r = emoji_count(s);
+  REQUIRE(r == total * 7);
+  free(s);
+}
+
+TEST_CASE("`emoji_count` joins skin tones, U+FE0F and ZWJs across vectorized steps", "[weight=3][part=1]") {
+  // A thumbs up with a skin tone, U+FE0F and a ZWJ to a fire; U+1F110 (not Extended_Pictographic) and ASCII,
+  // which a ZWJ does not join to the emoji after it; a family with a skin tone; and a rainbow flag:
+  const char *piece = "\xF0\x9F\x91\x8D\xF0\x9F\x8F\xBB\xEF\xB8\x8F\xE2\x80\x8D\xF0\x9F\x94\xA5 "
+                      "\xF0\x9F\x84\x90\xE2\x80\x8D\xF0\x9F\x98\x8A a\xE2\x80\x8D\xF0\x9F\x98\x8A "
+                      "\xF0\x9F\x91\xA8\xF0\x9F\x8F\xBF\xE2\x80\x8D\xF0\x9F\x91\xA9\xE2\x80\x8D\xF0\x9F\x91\xA7"
+                      "\xE2\x80\x8D\xF0\x9F\x91\xA6\xF0\x9F\x8F\xB3\xEF\xB8\x8F\xE2\x80\x8D\xF0\x9F\x8C\x88";
+  REQUIRE(emoji_count(piece) == 6);
+
+  // Each sequence split by a step boundary at every offset, with and without ASCII in between:
+  const int total = 100;
+  size_t pieceLen = strlen(piece);
+  char *s = (char *) malloc(total * (pieceLen + 40) + 1);
+  char *p = s;
+  for (int i = 0; i < total; i++) {
+    for (int pad = 0; pad < i % 33; pad++) { *p++ = 'a'; }
+    memcpy(p, piece, pieceLen);
+    p += pieceLen;
+    if (i % 2) { memcpy(p, "\xF0\x9F\x98\x8A", 4); p += 4; }  // Another lone emoji.
+  }
+  *p = '\0';
+  int r = emoji_count(s);
+  REQUIRE(r == total * 6 + total / 2);
+  free(s);
+}
+
 TEST_CASE("`emoji_invertChar` inverts smiley face into another emoji", "[weight=3][part=1]") {
   char *s = (char *)malloc(100);
   strcpy(s, "\xF0\x9F\x98\x8A");
@@ -249,4 +319,102 @@ TEST_CASE("`emoji_invertFile_alloc` inverts all emojis - no emoji in text", "[we
 TEST_CASE("`emoji_invertFile_alloc` invalid file name", "[weight=3][part=1]") {
   unsigned char *inverted_content = emoji_invertFile_alloc("tests/txt/nonexistent.txt");
   REQUIRE(inverted_content == NULL);
-}
\ No newline at end of file
+}
+
+TEST_CASE("`emoji_invertStream` matches `emoji_invertAll` across chunk boundaries", "[weight=3][part=1]") {
+  // Several chunks' worth of text, with smiley faces at every offset so some are split by a chunk boundary:
+  const size_t len = 3 * 64 * 1024 + 1000;
+  char *s = (char *) malloc(len + 8);
+  size_t n = 0;
+  for (int i = 0; n < len; i++) {
+    for (int pad = 0; pad < i % 4; pad++) { s[n++] = 'x'; }
+    memcpy(s + n, "\xF0\x9F\x98\x8A", 4);
+    n += 4;
+  }
+  s[n] = '\0';
+
+  FILE *in = tmpfile();
+  FILE *out = tmpfile();
+  REQUIRE(in != NULL);
+  REQUIRE(out != NULL);
+  fwrite(s, 1, n, in);
+  fflush(in);
+  rewind(in);
+  REQUIRE(emoji_invertStream(fileno(in), fileno(out)) == 0);
+
+  char *streamed = (char *) malloc(n + 1);
+  rewind(out);
+  REQUIRE(fread(streamed, 1, n + 1, out) == n);
+  streamed[n] = '\0';
+
+  emoji_invertAll(s);
+  REQUIRE(strstr(s, "\xF0\x9F\x98\x8A") == NULL);
+  REQUIRE(strcmp(streamed, s) == 0);
+
+  fclose(in);
+  fclose(out);
+  free(streamed);
+  free(s);
+}
+
+TEST_CASE("`emoji_invertFile_fd` and `emoji_count_file` work on the mapped file", "[weight=3][part=1]") {
+  unsigned char *expected = emoji_invertFile_alloc("tests/txt/invert-long.txt");
+  REQUIRE(expected != NULL);
+  size_t n = strlen((char *) expected);
+
+  FILE *out = tmpfile();
+  REQUIRE(out != NULL);
+  REQUIRE(emoji_invertFile_fd("tests/txt/invert-long.txt", fileno(out)) == 0);
+  char *written = (char *) malloc(n + 2);
+  rewind(out);
+  REQUIRE(fread(written, 1, n + 1, out) == n);
+  written[n] = '\0';
+  REQUIRE(strcmp(written, (char *) expected) == 0);
+
+  // Inverting works on a private copy of the pages, never on the file itself:
+  FILE *file = fopen("tests/txt/invert-long.txt", "r");
+  REQUIRE(fread(written, 1, n + 1, file) == n);
+  REQUIRE(strncmp(written, (char *) expected, n) != 0);
+  REQUIRE(emoji_count_file("tests/txt/invert-long.txt") == emoji_count(written));
+  REQUIRE(emoji_count_file("tests/txt/nonexistent.txt") == -1);
+
+  fclose(file);
+  fclose(out);
+  free(written);
+  free(expected);
+}
+
+TEST_CASE("`emoji_invertFile_fd` invalid file name", "[weight=3][part=1]") {
+  REQUIRE(emoji_invertFile_fd("tests/txt/nonexistent.txt", 1) == -1);
+}
+
+TEST_CASE("`emoji_invert_register` adds an inversion", "[weight=3][part=1]") {
+  char *s = (char *) malloc(100);
+  strcpy(s, "\xF0\x9F\x8E\x89 \xF0\x9F\x98\x8A");
+  REQUIRE(emoji_invert_register("\xF0\x9F\x8E\x89", "U+1F622") == 0);
+  emoji_invertAll(s);
+  REQUIRE(strncmp(s, "\xF0\x9F\x98\xA2", 4) == 0);
+  REQUIRE(strncmp(s + 5, "\xF0\x9F\x98\x8A", 4) != 0);
+
+  REQUIRE(emoji_invert_register("not an emoji", "\xF0\x9F\x98\xA2") == -1);
+  REQUIRE(emoji_invert_register("U+1FB00", "\xF0\x9F\x98\xA2") == -1);
+
+  emoji_invert_reset();
+  strcpy(s, "\xF0\x9F\x8E\x89");
+  emoji_invertAll(s);
+  REQUIRE(strcmp(s, "\xF0\x9F\x8E\x89") == 0);
+  free(s);
+}
+
+TEST_CASE("`emoji_invert_load` registers a set of inversions", "[weight=3][part=1]") {
+  REQUIRE(emoji_invert_load("tests/txt/invert-set.txt") == 3);
+
+  char *s = (char *) malloc(100);
+  strcpy(s, "\xF0\x9F\x91\x8D\xF0\x9F\x91\x8E\xF0\x9F\x99\x82");
+  emoji_invertAll(s);
+  REQUIRE(strcmp(s, "\xF0\x9F\x91\x8E\xF0\x9F\x91\x8D\xF0\x9F\x99\x83") == 0);
+  free(s);
+
+  REQUIRE(emoji_invert_load("tests/txt/nonexistent.txt") == -1);
+  emoji_invert_reset();
+}
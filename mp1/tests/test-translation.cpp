@@ -249,3 +249,147 @@ TEST_CASE("translate long text - translation with many translations", "[weight=4
 
   emoji_destroy(&emoji);
 }
+
+TEST_CASE("translate long text - longest match restarts after words and partial matches", "[weight=4][part=2]") {
+  emoji_t emoji;
+  emoji_init(&emoji);
+
+  emoji_add_translation(&emoji, (const unsigned char *)"🙅", (const unsigned char *)"no");
+  emoji_add_translation(&emoji, (const unsigned char *)"🙅👄💬", (const unsigned char *)"We don't talk");
+  emoji_add_translation(&emoji, (const unsigned char *)"🙅👄💬🧑🔮", (const unsigned char *)"We don't talk about Bruno");
+  emoji_add_translation(&emoji, (const unsigned char *)"🧑🔮", (const unsigned char *)"Bruno");
+  emoji_add_translation(&emoji, (const unsigned char *)"🧑🔮🚶😈🤫", (const unsigned char *)"never matched");
+  emoji_add_translation(&emoji, (const unsigned char *)"🧑", (const unsigned char *)"shadowed");
+  emoji_add_translation(&emoji, (const unsigned char *)"🧑🔮", (const unsigned char *)"duplicate");
+
+  const char* expected = "We don't talkabout Brunononono?\n"
+  "We don't talk about Bruno🖐\n"
+  "💒👰💍🤵\n"
+  "💄💅💇no🌤🌄\n"
+  "Brunosays Bruno🚶😈\n"
+  "😠🗯🗨💢🤫";
+
+  unsigned char *translation = (unsigned char *) emoji_translate_file_alloc(&emoji, "tests/txt/long-with-words.txt");
+  REQUIRE(translation != NULL);
+
+  INFO("translation := " << translation);
+  REQUIRE(strcmp((char *) translation, expected) == 0);
+  free(translation);
+
+  emoji_destroy(&emoji);
+}
+
+TEST_CASE("translate long text - translations loaded from a TSV file", "[weight=4][part=2]") {
+  emoji_t emoji;
+  emoji_init(&emoji);
+
+  REQUIRE(emoji_load_translations(&emoji, "tests/txt/long.tsv") == 8);
+  REQUIRE(emoji.count == 7);
+  REQUIRE(strcmp((const char *) emoji_lookup(&emoji, (const unsigned char *)"🙅"), "no, ") == 0);
+  REQUIRE(emoji_lookup(&emoji, (const unsigned char *)"🙅👄") == NULL);
+
+  const char* expected = "We don't talk about Bruno, no, no, no, \n"
+  "We don't talk about Bruno, but \n"
+  "It was my wedding day \n"
+  "We were getting ready, and there wasn't a cloud in the sky \n"
+  "Bruno walks in with a mischievous grin \n"
+  "You telling this story or am I?";
+
+  unsigned char *translation = (unsigned char *) emoji_translate_file_alloc(&emoji, "tests/txt/long.txt");
+  REQUIRE(translation != NULL);
+
+  INFO("translation := " << translation);
+  REQUIRE(strcmp((char *) translation, expected) == 0);
+  free(translation);
+
+  REQUIRE(emoji_load_translations(&emoji, "tests/txt/nonexistent.tsv") == -1);
+  emoji_destroy(&emoji);
+}
+
+TEST_CASE("translate in parallel - matches `replace` on a multi-chunk string and on files", "[weight=4][part=2]") {
+  emoji_t emoji;
+  emoji_init(&emoji);
+  REQUIRE(emoji_load_translations(&emoji, "tests/txt/long.tsv") == 8);
+
+  // About 5 MB of long.txt (a few parallel chunks), including long runs of emoji with no ASCII between them:
+  FILE *file = fopen("tests/txt/long.txt", "r");
+  char piece[512];
+  size_t pieceLen = fread(piece, 1, sizeof(piece), file);
+  fclose(file);
+  const size_t reps = 40000;
+  unsigned char *text = (unsigned char *) malloc(pieceLen * reps + 1);
+  for (size_t r = 0; r < reps; r++) {
+    memcpy(text + r * pieceLen, piece, pieceLen);
+    if (r % 1000 == 0) { text[r * pieceLen + pieceLen - 1] = 0xF0; }  // Glue a run onto the next piece.
+  }
+  text[pieceLen * reps] = '\0';
+
+  unsigned char *expected = replace(&emoji, text);
+  unsigned char *parallel = emoji_translate_parallel_alloc(&emoji, text, 4);
+  REQUIRE(strcmp((char *) parallel, (char *) expected) == 0);
+  free(parallel);
+  free(expected);
+  free(text);
+
+  const char *files[] = { "tests/txt/simple.txt", "tests/txt/nonexistent.txt", "tests/txt/long.txt" };
+  unsigned char **translations = emoji_translate_files_alloc(&emoji, files, 3, 2);
+  REQUIRE(translations[1] == NULL);
+  for (int f = 0; f < 3; f += 2) {
+    unsigned char *single = (unsigned char *) emoji_translate_file_alloc(&emoji, files[f]);
+    REQUIRE(strcmp((char *) translations[f], (char *) single) == 0);
+    free(single);
+    free(translations[f]);
+  }
+  free(translations);
+
+  emoji_destroy(&emoji);
+}
+
+TEST_CASE("translate - sources match whole emoji sequences", "[weight=4][part=2]") {
+  emoji_t emoji;
+  emoji_init(&emoji);
+
+  emoji_add_translation(&emoji, (const unsigned char *)"👍", (const unsigned char *)"thumbs up");
+  emoji_add_translation(&emoji, (const unsigned char *)"👍🏽", (const unsigned char *)"thumbs up (medium)");
+  emoji_add_translation(&emoji, (const unsigned char *)"🇺🇸", (const unsigned char *)"US");
+  emoji_add_translation(&emoji, (const unsigned char *)"👨", (const unsigned char *)"man");
+  emoji_add_translation(&emoji, (const unsigned char *)"👨‍👩‍👧", (const unsigned char *)"family");
+  emoji_add_translation(&emoji, (const unsigned char *)"☘️", (const unsigned char *)"shamrock");
+  emoji_add_translation(&emoji, (const unsigned char *)"1️⃣", (const unsigned char *)"one");
+
+  // The skin tone and the family stay whole when there is no source for them,
+  // and the regional indicators pair up as CA + US, not US + US:
+  unsigned char *translation = replace(&emoji, (unsigned char *)
+    "👍🏽 👍🏿👍 ☘️🇺🇸🇨🇦🇺🇸 👨‍👩‍👧👨 👨‍👩 x1️⃣ 1");
+  INFO("translation := " << translation);
+  REQUIRE(strcmp((char *) translation,
+    "thumbs up (medium) 👍🏿thumbs up shamrockUS🇨🇦US familyman 👨‍👩 xone 1") == 0);
+  free(translation);
+
+  emoji_destroy(&emoji);
+}
+
+TEST_CASE("translate - `emoji_translate_file_fd` writes the same translation", "[weight=4][part=2]") {
+  emoji_t emoji;
+  emoji_init(&emoji);
+  REQUIRE(emoji_load_translations(&emoji, "tests/txt/long.tsv") == 8);
+
+  unsigned char *expected = (unsigned char *) emoji_translate_file_alloc(&emoji, "tests/txt/long.txt");
+  REQUIRE(expected != NULL);
+  size_t n = strlen((char *) expected);
+
+  FILE *out = tmpfile();
+  REQUIRE(out != NULL);
+  REQUIRE(emoji_translate_file_fd(&emoji, "tests/txt/long.txt", fileno(out)) == 0);
+  char *written = (char *) malloc(n + 2);
+  rewind(out);
+  REQUIRE(fread(written, 1, n + 1, out) == n);
+  written[n] = '\0';
+  REQUIRE(strcmp(written, (char *) expected) == 0);
+  REQUIRE(emoji_translate_file_fd(&emoji, "tests/txt/nonexistent.txt", fileno(out)) == -1);
+
+  fclose(out);
+  free(written);
+  free(expected);
+  emoji_destroy(&emoji);
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../utf8.h"
+#include "../grapheme.h"
+#include "../emoji.h"
+#include "../emoji-translate.h"
+#include "lib/catch.hpp"
+
+
+static uint32_t decode(const char *s, size_t *size) {
+  return utf8_decode((const unsigned char *) s, strlen(s), size);
+}
+
+
+TEST_CASE("`utf8_decode` decodes one to four byte sequences", "[weight=1][part=1]") {
+  size_t size;
+  REQUIRE(decode("A", &size) == 'A');
+  REQUIRE(size == 1);
+  REQUIRE(decode("\xC3\xA9", &size) == 0xE9);
+  REQUIRE(size == 2);
+  REQUIRE(decode("\xE2\x98\x98", &size) == 0x2618);
+  REQUIRE(size == 3);
+  REQUIRE(decode("\xF0\x9F\x98\x8A", &size) == 0x1F60A);
+  REQUIRE(size == 4);
+  REQUIRE(decode("\xF4\x8F\xBF\xBF", &size) == 0x10FFFF);
+  REQUIRE(size == 4);
+}
+
+TEST_CASE("`utf8_decode` rejects malformed sequences and resumes at the byte that broke them", "[weight=1][part=1]") {
+  size_t size;
+  REQUIRE(decode("\x80", &size) == UTF8_INVALID);          // Lone continuation byte.
+  REQUIRE(size == 1);
+  REQUIRE(decode("\xC0\xAF", &size) == UTF8_INVALID);      // Overlong '/'.
+  REQUIRE(size == 1);
+  REQUIRE(decode("\xE0\x80\x80", &size) == UTF8_INVALID);  // Overlong NUL.
+  REQUIRE(size == 1);
+  REQUIRE(decode("\xED\xA0\x80", &size) == UTF8_INVALID);  // Surrogate.
+  REQUIRE(size == 1);
+  REQUIRE(decode("\xF4\x90\x80\x80", &size) == UTF8_INVALID);  // Past U+10FFFF.
+  REQUIRE(size == 1);
+  REQUIRE(decode("\xF0\x9F\x98" "A", &size) == UTF8_INVALID);  // Cut short by 'A'.
+  REQUIRE(size == 3);
+  REQUIRE(decode("\xF0\x9F", &size) == UTF8_INVALID);      // Truncated by the end of input.
+  REQUIRE(size == 2);
+}
+
+TEST_CASE("`utf8_valid`, `utf8_ascii_run` and `utf8_incomplete_tail`", "[weight=1][part=1]") {
+  const char *valid = "plain ASCII text, long enough for a vector step \xF0\x9F\x98\x8A \xE2\x98\x98\xEF\xB8\x8F";
+  REQUIRE(utf8_valid((const unsigned char *) valid, strlen(valid)) == 1);
+  REQUIRE(utf8_ascii_run((const unsigned char *) valid, strlen(valid)) == strlen("plain ASCII text, long enough for a vector step "));
+  REQUIRE(utf8_valid((const unsigned char *) "\xF0\x9F\x98", 3) == 0);
+  REQUIRE(utf8_valid((const unsigned char *) "ok \xFF", 4) == 0);
+
+  REQUIRE(utf8_incomplete_tail((const unsigned char *) "ab\xF0\x9F\x98", 5) == 3);
+  REQUIRE(utf8_incomplete_tail((const unsigned char *) "ab\xE2\x98", 4) == 2);
+  REQUIRE(utf8_incomplete_tail((const unsigned char *) "ab\xE2\x98\x98", 5) == 0);
+  REQUIRE(utf8_incomplete_tail((const unsigned char *) "ab\xED\xA0", 4) == 0);
+}
+
+static size_t cluster(const char *s) {
+  return grapheme_next((const unsigned char *) s, strlen(s));
+}
+
+TEST_CASE("`grapheme_next` finds whole grapheme clusters", "[weight=1][part=1]") {
+  REQUIRE(cluster("") == 0);
+  REQUIRE(cluster("ab") == 1);
+  REQUIRE(cluster("\r\nx") == 2);
+  REQUIRE(cluster("\n\rx") == 1);
+  REQUIRE(cluster("e\xCC\x81x") == 3);                                          // e + combining acute
+  REQUIRE(cluster("\xE1\x84\x92\xE1\x85\xA1\xE1\x86\xAB\xE1\x84\x92") == 9);  // Hangul L V T, then L
+  REQUIRE(cluster("\xF0\x9F\x91\x8D\xF0\x9F\x8F\xBDx") == 8);                   // Thumbs up + skin tone
+  REQUIRE(cluster("\xE2\x98\x98\xEF\xB8\x8F\xE2\x98\x98") == 6);                // Shamrock + VS16
+  // Man ZWJ woman ZWJ girl is one cluster, but a ZWJ only joins pictographs:
+  REQUIRE(cluster("\xF0\x9F\x91\xA8\xE2\x80\x8D\xF0\x9F\x91\xA9\xE2\x80\x8D\xF0\x9F\x91\xA7!") == 18);
+  REQUIRE(cluster("a\xE2\x80\x8D\xF0\x9F\x91\xA9") == 4);
+  // Regional indicators pair up into flags: US, CA, then a lone one.
+  const char *flags = "\xF0\x9F\x87\xBA\xF0\x9F\x87\xB8\xF0\x9F\x87\xA8\xF0\x9F\x87\xA6\xF0\x9F\x87\xBA";
+  REQUIRE(cluster(flags) == 8);
+  REQUIRE(cluster(flags + 8) == 8);
+  REQUIRE(cluster(flags + 16) == 4);
+  // A malformed sequence is a cluster of its own, but can still be extended:
+  REQUIRE(cluster("\xF0\x9F\x98\xF0\x9F\x98\x8A") == 3);
+  REQUIRE(cluster("\xF0\x9F\x98\xCC\x81") == 5);
+}
+
+TEST_CASE("emoji functions stay within truncated and malformed input", "[weight=1][part=1]") {
+  // Each string ends partway through an emoji, right at its terminator:
+  const char *inputs[] = { "\xF0", "\xF0\x9F", "\xF0\x9F\x98", "x\xF0\x9F\x98\x8A\xF0\x9F\x98", "\xE0\x9F\x92\xF0\x9F\x98\x8A" };
+  const int counts[] = { 0, 0, 0, 1, 1 };
+  for (int i = 0; i < 5; i++) {
+    size_t len = strlen(inputs[i]);
+    char *s = (char *) malloc(len + 1);
+    memcpy(s, inputs[i], len + 1);
+    REQUIRE(emoji_count(s) == counts[i]);
+    emoji_invertAll((unsigned char *) s);
+    REQUIRE(strlen(s) == len);
+    free(s);
+  }
+
+  emoji_t emoji;
+  emoji_init(&emoji);
+  emoji_add_translation(&emoji, (const unsigned char *) "\xF0\x9F\x98\x8A", (const unsigned char *) ":)");
+  unsigned char *translation = replace(&emoji, (unsigned char *) "\xF0\x9F\xF0\x9F\x98\x8A\xF0\x9F\x98");
+  REQUIRE(strcmp((char *) translation, "\xF0\x9F:)\xF0\x9F\x98") == 0);
+  free(translation);
+  emoji_destroy(&emoji);
+}
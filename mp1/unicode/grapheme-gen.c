@@ -0,0 +1,190 @@
+/**
+ * Generates grapheme-table.h, the tables behind grapheme.c, from the Unicode
+ * properties in grapheme-break.txt (see that file):
+ *
+ *   ./grapheme-gen grapheme-break.txt > grapheme-table.h
+ *
+ * - graphemeStage1/graphemeStage2 map every code point to its class, a
+ *   Grapheme_Cluster_Break value or GRAPHEME_EXT_PICT, in two lookups.
+ * - graphemeTransition is a DFA over those classes that applies the rules of
+ *   UAX #29 (GB3-GB13): the state is what the rules need to know about the
+ *   cluster so far, and each entry is the next state, with GRAPHEME_BREAK set
+ *   if a cluster boundary comes before the new code point.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CODE_POINTS 0x110000
+#define BLOCK_SHIFT 7
+#define BLOCK_SIZE (1 << BLOCK_SHIFT)
+#define BLOCKS (CODE_POINTS >> BLOCK_SHIFT)
+
+// The classes, in the order of the GRAPHEME_* names written out below:
+enum { OTHER, CR, LF, CONTROL, EXTEND, ZWJ, REGIONAL_INDICATOR, PREPEND, SPACING_MARK,
+       L, V, T, LV, LVT, EXT_PICT, CLASSES };
+static const char *classNames[CLASSES] = {
+  "Other", "CR", "LF", "Control", "Extend", "ZWJ", "Regional_Indicator", "Prepend", "SpacingMark",
+  "L", "V", "T", "LV", "LVT", "Extended_Pictographic",
+};
+static const char *classMacros[CLASSES] = {
+  "OTHER", "CR", "LF", "CONTROL", "EXTEND", "ZWJ", "REGIONAL_INDICATOR", "PREPEND", "SPACING_MARK",
+  "L", "V", "T", "LV", "LVT", "EXT_PICT",
+};
+
+// The DFA states are the class of the last code point, except for three that carry more context:
+enum {
+  PICT_EXTEND = CLASSES,  // Extend after Extended_Pictographic Extend*
+  PICT_ZWJ,               // ZWJ after Extended_Pictographic Extend* (GB11)
+  RI_PAIR,                // The second Regional_Indicator of a pair (GB12/13)
+  STATES
+};
+// (A REGIONAL_INDICATOR state is always the first of a pair.)
+
+static unsigned char classOf[CODE_POINTS];
+
+
+static int nextState(int state, int c) {
+  int pict = (state == EXT_PICT || state == PICT_EXTEND);
+  if (c == EXTEND && pict) { return PICT_EXTEND; }
+  if (c == ZWJ && pict) { return PICT_ZWJ; }
+  if (c == REGIONAL_INDICATOR && state == REGIONAL_INDICATOR) { return RI_PAIR; }
+  return c;
+}
+
+// Returns 1 if UAX #29 puts a boundary between a cluster in `state` and a code point of class `c`.
+static int isBreak(int state, int c) {
+  int prev = state;
+  if (state == PICT_EXTEND) { prev = EXTEND; }
+  if (state == PICT_ZWJ) { prev = ZWJ; }
+  if (state == RI_PAIR) { prev = REGIONAL_INDICATOR; }
+
+  if (prev == CR && c == LF) { return 0; }                                           // GB3
+  if (prev == CONTROL || prev == CR || prev == LF) { return 1; }                     // GB4
+  if (c == CONTROL || c == CR || c == LF) { return 1; }                              // GB5
+  if (prev == L && (c == L || c == V || c == LV || c == LVT)) { return 0; }          // GB6
+  if ((prev == LV || prev == V) && (c == V || c == T)) { return 0; }                 // GB7
+  if ((prev == LVT || prev == T) && c == T) { return 0; }                            // GB8
+  if (c == EXTEND || c == ZWJ) { return 0; }                                         // GB9
+  if (c == SPACING_MARK) { return 0; }                                               // GB9a
+  if (prev == PREPEND) { return 0; }                                                 // GB9b
+  if (state == PICT_ZWJ && c == EXT_PICT) { return 0; }                              // GB11
+  if (state == REGIONAL_INDICATOR && c == REGIONAL_INDICATOR) { return 0; }          // GB12, GB13
+  return 1;                                                                          // GB999
+}
+
+
+static int parseClass(const char *name) {
+  for (int c = 0; c < CLASSES; c++) {
+    if (strcmp(name, classNames[c]) == 0) { return c; }
+  }
+  return -1;
+}
+
+static int load(const char *fileName) {
+  FILE *file = fopen(fileName, "r");
+  if (!file) {
+    perror(fileName);
+    return -1;
+  }
+
+  char line[512];
+  int lineNumber = 0;
+  while (fgets(line, sizeof(line), file)) {
+    lineNumber++;
+    char *comment = strchr(line, '#');
+    if (comment) { *comment = '\0'; }
+
+    unsigned int low, high;
+    char name[64];
+    int fields = sscanf(line, "%x..%x ; %63[A-Za-z_]", &low, &high, name);
+    if (fields < 3) {
+      high = low;
+      fields = sscanf(line, "%x ; %63[A-Za-z_]", &low, name) + 1;
+    }
+    if (fields < 3) {
+      if (strspn(line, " \t\r\n") != strlen(line)) {
+        fprintf(stderr, "%s:%d: cannot parse the line\n", fileName, lineNumber);
+        fclose(file);
+        return -1;
+      }
+      continue;
+    }
+
+    int c = parseClass(name);
+    if (c < 0 || high >= CODE_POINTS || low > high) {
+      fprintf(stderr, "%s:%d: unknown property or bad range\n", fileName, lineNumber);
+      fclose(file);
+      return -1;
+    }
+    for (unsigned int cp = low; cp <= high; cp++) {
+      // Extended_Pictographic code points are all Grapheme_Cluster_Break=Other:
+      if (c != EXT_PICT || classOf[cp] == OTHER) { classOf[cp] = c; }
+    }
+  }
+  fclose(file);
+  return 0;
+}
+
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s grapheme-break.txt > grapheme-table.h\n", argv[0]);
+    return 1;
+  }
+  if (load(argv[1]) != 0) {
+    return 2;
+  }
+
+  // Share identical blocks of BLOCK_SIZE code points:
+  static unsigned short stage1[BLOCKS];
+  static unsigned int blockStart[BLOCKS];
+  int blocks = 0;
+  for (int b = 0; b < BLOCKS; b++) {
+    int found = -1;
+    for (int u = 0; u < blocks && found < 0; u++) {
+      if (memcmp(classOf + blockStart[u], classOf + b * BLOCK_SIZE, BLOCK_SIZE) == 0) { found = u; }
+    }
+    if (found < 0) {
+      found = blocks;
+      blockStart[blocks++] = b * BLOCK_SIZE;
+    }
+    stage1[b] = found;
+  }
+
+  printf("// Generated by unicode/grapheme-gen.c from %s; do not edit.\n", argv[1]);
+  printf("#pragma once\n\n");
+  for (int c = 0; c < CLASSES; c++) {
+    printf("#define GRAPHEME_%s %d\n", classMacros[c], c);
+  }
+  printf("\n#define GRAPHEME_BLOCK_SHIFT %d\n", BLOCK_SHIFT);
+  printf("#define GRAPHEME_BREAK 0x80\n");
+  printf("#define GRAPHEME_STATE_MASK 0x7F\n\n");
+
+  printf("static const unsigned short graphemeStage1[%d] = {", BLOCKS);
+  for (int b = 0; b < BLOCKS; b++) {
+    printf("%s%d,", (b % 16) ? " " : "\n  ", stage1[b]);
+  }
+  printf("\n};\n\n");
+
+  printf("static const unsigned char graphemeStage2[%d][%d] = {\n", blocks, BLOCK_SIZE);
+  for (int u = 0; u < blocks; u++) {
+    printf("  {");
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+      printf("%s%d,", (i % 32) ? "" : "\n    ", classOf[blockStart[u] + i]);
+    }
+    printf("\n  },\n");
+  }
+  printf("};\n\n");
+
+  printf("static const unsigned char graphemeTransition[%d][%d] = {\n", STATES, CLASSES);
+  for (int state = 0; state < STATES; state++) {
+    printf("  {");
+    for (int c = 0; c < CLASSES; c++) {
+      printf("%s0x%02X", c ? ", " : " ", (isBreak(state, c) ? 0x80 : 0) | nextState(state, c));
+    }
+    printf(" },\n");
+  }
+  printf("};\n");
+  return 0;
+}
@@ -0,0 +1,148 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "utf8.h"
+
+/*
+ * UTF-8 is decoded with a DFA (after Bjoern Hoehrmann's): each byte is mapped
+ * to one of 12 classes, and the next state is looked up from the current
+ * state and the class.  States are multiples of 12 so they index the
+ * transition rows directly; UTF8_ACCEPT is "between code points" and
+ * UTF8_REJECT is a malformed sequence (overlong forms, surrogates, and code
+ * points past U+10FFFF included).
+ */
+#define UTF8_ACCEPT 0
+#define UTF8_REJECT 12
+
+static const unsigned char utf8Class[256] = {
+  // 00..7F: ASCII
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  // 80..BF: continuation bytes, split by the ranges E0, ED, F0 and F4 allow
+  1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1, 9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,
+  7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7, 7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
+  // C0..DF: 2-byte leads (C0 and C1 only start overlong forms)
+  8,8,2,2,2,2,2,2,2,2,2,2,2,2,2,2, 2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,
+  // E0..EF: 3-byte leads; F0..F4: 4-byte leads; F5..FF: never valid
+  10,3,3,3,3,3,3,3,3,3,3,3,3,4,3,3, 11,6,6,6,5,8,8,8,8,8,8,8,8,8,8,8,
+};
+
+static const unsigned char utf8Transition[108] = {
+  // 0: UTF8_ACCEPT
+  0,12,24,36,60,96,84,12,12,12,48,72,
+  // 12: UTF8_REJECT
+  12,12,12,12,12,12,12,12,12,12,12,12,
+  // 24: one continuation byte left
+  12,0,12,12,12,12,12,0,12,0,12,12,
+  // 36: two left
+  12,24,12,12,12,12,12,24,12,24,12,12,
+  // 48: after E0, A0..BF
+  12,12,12,12,12,12,12,24,12,12,12,12,
+  // 60: after ED, 80..9F
+  12,24,12,12,12,12,12,12,12,24,12,12,
+  // 72: after F0, 90..BF
+  12,12,12,12,12,12,12,36,12,36,12,12,
+  // 84: three left
+  12,36,12,12,12,12,12,36,12,36,12,12,
+  // 96: after F4, 80..8F
+  12,36,12,12,12,12,12,12,12,12,12,12,
+};
+
+
+/**
+ * Decodes the code point at the start of the `len` bytes at `s` (len > 0),
+ * setting `*size` to the bytes it took.  A malformed sequence decodes as
+ * UTF8_INVALID, with `*size` covering only its valid prefix (at least one
+ * byte), so decoding resumes at the byte that broke it; a sequence cut off by
+ * the end of the input takes the rest of the input.
+ */
+uint32_t utf8_decode(const unsigned char *s, size_t len, size_t *size) {
+  uint32_t state = UTF8_ACCEPT;
+  uint32_t codePoint = 0;
+  for (size_t i = 0; i < len; i++) {
+    uint32_t type = utf8Class[s[i]];
+    codePoint = (state != UTF8_ACCEPT) ? (s[i] & 0x3Fu) | (codePoint << 6) : (0xFFu >> type) & s[i];
+    state = utf8Transition[state + type];
+    if (state == UTF8_ACCEPT) {
+      *size = i + 1;
+      return codePoint;
+    } else if (state == UTF8_REJECT) {
+      *size = i ? i : 1;
+      return UTF8_INVALID;
+    }
+  }
+  *size = len;
+  return UTF8_INVALID;
+}
+
+
+/**
+ * Returns how many bytes at the start of the `len` bytes at `s` are ASCII,
+ * checking 16 at a time where SSE2 is available.
+ */
+size_t utf8_ascii_run(const unsigned char *s, size_t len) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 16 <= len; i += 16) {
+    int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+  while (i < len && s[i] < 0x80) {
+    i++;
+  }
+  return i;
+}
+
+
+/**
+ * Returns how many bytes at the end of the `len` bytes at `s` are the start
+ * of a sequence that is valid so far but incomplete (0 to 3): the bytes a
+ * reader of a stream should hold back until more input arrives.
+ */
+size_t utf8_incomplete_tail(const unsigned char *s, size_t len) {
+  for (size_t back = 1; back <= 3 && back <= len; back++) {
+    unsigned char c = s[len - back];
+    if ((c & 0xC0) == 0x80) {
+      continue;
+    } else if (c < 0x80) {
+      return 0;
+    }
+
+    uint32_t state = UTF8_ACCEPT;
+    for (size_t i = len - back; i < len; i++) {
+      state = utf8Transition[state + utf8Class[s[i]]];
+    }
+    return (state != UTF8_ACCEPT && state != UTF8_REJECT) ? back : 0;
+  }
+  return 0;
+}
+
+
+/**
+ * Returns 1 if the `len` bytes at `s` are entirely valid UTF-8, or 0.
+ */
+int utf8_valid(const unsigned char *s, size_t len) {
+  uint32_t state = UTF8_ACCEPT;
+  for (size_t i = 0; i < len; ) {
+    if (state == UTF8_ACCEPT) {
+      i += utf8_ascii_run(s + i, len - i);
+      if (i == len) {
+        break;
+      }
+    }
+    state = utf8Transition[state + utf8Class[s[i++]]];
+    if (state == UTF8_REJECT) {
+      return 0;
+    }
+  }
+  return state == UTF8_ACCEPT;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returned by `utf8_decode` for a malformed or truncated sequence:
+#define UTF8_INVALID 0xFFFFFFFFu
+
+uint32_t utf8_decode(const unsigned char *s, size_t len, size_t *size);
+size_t utf8_ascii_run(const unsigned char *s, size_t len);
+size_t utf8_incomplete_tail(const unsigned char *s, size_t len);
+int utf8_valid(const unsigned char *s, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,7 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "crc32.h"
 #include "png.h"
@@ -12,6 +15,77 @@ const int ERROR_INVALID_CHUNK_DATA = 3;
 const int ERROR_NO_UIUC_CHUNK = 4;
 const unsigned char UIUC_SIGNATURE[8] = { 0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a };
 
+// Every PNG read from memory, so PNG_free_chunk can tell whose memory a chunk's data is in:
+static PNG *memoryPNGs = NULL;
+
+
+/**
+ * Loads all of `fp` into `png->data`: mapped privately (so chunk data can be
+ * written to like a copy, without touching the file) if it is a regular
+ * file, or otherwise read into one heap buffer.  Returns 0 on success.
+ */
+static int loadFile(PNG *png, FILE *fp) {
+  struct stat st;
+  if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+    if (data != MAP_FAILED) {
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      png->data = data;
+      png->size = st.st_size;
+      png->mapped = 1;
+      return 0;
+    }
+  }
+
+  size_t capacity = 64 * 1024;
+  png->data = malloc(capacity);
+  png->size = 0;
+  png->mapped = 0;
+  size_t got;
+  while (png->data && (got = fread(png->data + png->size, 1, capacity - png->size, fp)) > 0) {
+    png->size += got;
+    if (png->size == capacity) {
+      capacity *= 2;
+      unsigned char *data = realloc(png->data, capacity);
+      if (!data) { free(png->data); }
+      png->data = data;
+    }
+  }
+  return (png->data && !ferror(fp)) ? 0 : -1;
+}
+
+// Frees the memory of a PNG read from memory, and the PNG itself.
+static void unloadFile(PNG *png) {
+  PNG **link = &memoryPNGs;
+  while (*link != png) { link = &(*link)->next; }
+  *link = png->next;
+
+  if (png->mapped) {
+    munmap(png->data, png->size);
+  } else {
+    free(png->data);
+  }
+  free(png);
+}
+
+// Returns the PNG whose memory `data` points into, or NULL if `data` was allocated on its own.
+static PNG *findOwner(const unsigned char *data) {
+  for (PNG *png = memoryPNGs; png && data; png = png->next) {
+    if (data >= png->data && data < png->data + png->size) {
+      return png;
+    }
+  }
+  return NULL;
+}
+
+// Marks a chunk read from `png` as no longer pointing into its memory.
+static void releaseChunk(PNG *png) {
+  png->borrowed--;
+  if (png->closed && png->borrowed == 0) {
+    unloadFile(png);
+  }
+}
+
 
 /**
  * Opens a PNG file for reading (mode == "r" or mode == "r+") or writing (mode == "w").
@@ -29,7 +103,25 @@ PNG * PNG_open(const char *filename, const char *mode) {
   if (fp == NULL) {
     return NULL;
   }
-  if (strcmp(mode, "r") == 0 || strcmp(mode, "r+") == 0) {
+  if (strcmp(mode, "r") == 0) {
+    // Read-only PNGs are read from memory, and need no FILE after that:
+    PNG *png = calloc(sizeof(PNG), 1);
+    int loaded = loadFile(png, fp);
+    fclose(fp);
+    if (loaded != 0 || png->size < 8 || memcmp(png->data, UIUC_SIGNATURE, 8) != 0) {
+      if (png->mapped) {
+        munmap(png->data, png->size);
+      } else {
+        free(png->data);
+      }
+      free(png);
+      return NULL;
+    }
+    png->offset = 8;
+    png->next = memoryPNGs;
+    memoryPNGs = png;
+    return png;
+  } else if (strcmp(mode, "r+") == 0) {
     unsigned char signature[8];
     fread(signature, 1, 8, fp);
     if (memcmp(signature, UIUC_SIGNATURE, 8) != 0) {
@@ -48,6 +140,47 @@ PNG * PNG_open(const char *filename, const char *mode) {
 }
 
 
+// Copies up to `len` bytes at the read position of `png` to `dest`, returning how many there were.
+static size_t take(PNG *png, void *dest, size_t len) {
+  size_t left = png->size - png->offset;
+  if (len > left) { len = left; }
+  memcpy(dest, png->data + png->offset, len);
+  png->offset += len;
+  return len;
+}
+
+/**
+ * PNG_read for a PNG read from memory: `chunk->data` points into the PNG's
+ * memory, and is only copied for a chunk that the end of the file cuts short
+ * (which gets zeros for its missing bytes, like a short fread would).
+ */
+static size_t readMemory(PNG *png, PNG_Chunk *chunk) {
+  size_t size = 0;
+  uint32_t len = 0, crc = 0;
+  size += (take(png, &len, 4) == 4) ? 4 : 0;
+  chunk->len = ntohl(len);
+  memset(chunk->type, 0, 5);
+  size += take(png, chunk->type, 4);
+
+  chunk->data = NULL;
+  if (chunk->len > 0) {
+    if (png->size - png->offset >= chunk->len) {
+      chunk->data = png->data + png->offset;
+      png->offset += chunk->len;
+      png->borrowed++;
+      size += chunk->len;
+    } else {
+      chunk->data = calloc(chunk->len, 1);
+      size += take(png, chunk->data, chunk->len);
+    }
+  }
+
+  size += (take(png, &crc, 4) == 4) ? 4 : 0;
+  chunk->crc = ntohl(crc);
+  return size;
+}
+
+
 /**
  * Reads the next PNG chunk from `png`.
  * 
@@ -57,8 +190,16 @@ PNG * PNG_open(const char *filename, const char *mode) {
  * 
  * Any memory allocated within `chunk` must be freed in `PNG_free_chunk`.
  * Users of the library must call `PNG_free_chunk` on all returned chunks.
+ *
+ * A PNG opened with "r" does not copy the chunk's data: it stays in the PNG's
+ * memory, valid (even past PNG_close) until the chunk is freed.  Call
+ * `PNG_own_chunk` to give the chunk a copy of its own instead.
  */
 size_t PNG_read(PNG *png, PNG_Chunk *chunk) {
+  if (png->data) {
+    return readMemory(png, chunk);
+  }
+
   size_t size = 0;
   chunk->len = 0;
   size += fread(&chunk->len, sizeof(u_int32_t), 1, png->fp) * sizeof(uint32_t);
@@ -106,13 +247,40 @@ size_t PNG_write(PNG *png, PNG_Chunk *chunk) {
  * Frees all memory allocated by this library related to `chunk`.
  */
 void PNG_free_chunk(PNG_Chunk *chunk) {
-  free(chunk->data);
+  PNG *owner = findOwner(chunk->data);
+  if (owner) {
+    releaseChunk(owner);
+  } else {
+    free(chunk->data);
+  }
+}
+
+/**
+ * Gives `chunk` its own copy of its data if it still points into the memory
+ * of the PNG it was read from.
+ */
+void PNG_own_chunk(PNG_Chunk *chunk) {
+  PNG *owner = findOwner(chunk->data);
+  if (owner) {
+    unsigned char *copy = malloc(chunk->len);
+    memcpy(copy, chunk->data, chunk->len);
+    chunk->data = copy;
+    releaseChunk(owner);
+  }
 }
 
 /**
  * Closes the PNG file and frees all memory related to `png`.
  */
 void PNG_close(PNG *png) {
+  if (png->data) {
+    // Chunks still pointing into the PNG's memory keep it until they are freed:
+    png->closed = 1;
+    if (png->borrowed == 0) {
+      unloadFile(png);
+    }
+    return;
+  }
   fclose(png->fp);
   free(png);
 }
\ No newline at end of file
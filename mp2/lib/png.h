@@ -1,4 +1,6 @@
 #pragma once
+#include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -9,9 +11,25 @@ extern "C" {
 struct _PNG {
   // Add any elements you need to store the PNG here:
   FILE *fp;
+
+  // A PNG opened with "r" is read from memory: the file is mapped (or, if it
+  // cannot be, read whole into the heap), and each chunk's data points into
+  // it rather than into a copy.
+  unsigned char *data;     // The whole file, or NULL when reading through `fp`.
+  size_t size;
+  size_t offset;           // The next byte PNG_read looks at.
+  int mapped;              // 1 if `data` is a mapping, 0 if it is on the heap.
+  unsigned int borrowed;   // Chunks read and not yet freed or owned, which still point into `data`.
+  int closed;              // PNG_close was called; `data` goes when the last chunk does.
+  struct _PNG *next;       // The list of PNGs read from memory, for PNG_free_chunk.
 };
 typedef struct _PNG PNG;
 
+// Makes `chunk` own a copy of its data, which PNG_read otherwise leaves in
+// the PNG's memory.  PNG_free_chunk still frees it either way.
+struct _PNG_Chunk;
+void PNG_own_chunk(struct _PNG_Chunk *chunk);
+
 
 // ===
 // === Note: Do not edit anything below this line.  This part of the library is fixed
@@ -76,6 +76,38 @@ TEST_CASE("`PNG_read` returns the correct return values", "[weight=5][part=1]")
   system("rm -f TEST_340.png");
 }
 
+TEST_CASE("`PNG_read` chunk data outlives `PNG_close` until freed, and `PNG_own_chunk` copies it", "[weight=1][part=1]") {
+  system("cp tests/files/340.png TEST_340.png");
+
+  const unsigned char ihdr[13] = { 0x00, 0x00, 0x01, 0x06, 0x00, 0x00, 0x00, 0x92, 0x08, 0x02, 0x00, 0x00, 0x00 };
+  PNG *png = PNG_open("TEST_340.png", "r");
+  PNG_Chunk borrowed, owned;
+
+  PNG_read(png, &borrowed);   // IHDR
+  PNG_read(png, &owned);      // pHYs
+  const unsigned char *phys = owned.data;
+  PNG_own_chunk(&owned);
+  CHECK(owned.data != phys);
+  PNG_close(png);
+
+  CHECK(memcmp(borrowed.data, ihdr, 13) == 0);
+  CHECK(memcmp(owned.data, "\x00\x00\x0e\xc3\x00\x00\x0e\xc3\x01", 9) == 0);
+  PNG_free_chunk(&borrowed);
+  PNG_free_chunk(&owned);
+
+  // Read from memory too, the four chunks are followed by the end of the file:
+  png = PNG_open("TEST_340.png", "r");
+  PNG_Chunk chunk;
+  for (int i = 0; i < 4; i++) {
+    CHECK(PNG_read(png, &chunk) > 0);
+    PNG_free_chunk(&chunk);
+  }
+  CHECK(PNG_read(png, &chunk) == 0);
+  PNG_close(png);
+
+  system("rm -f TEST_340.png");
+}
+
 TEST_CASE("`PNG_open` writes a correct PNG header", "[weight=1][part=1]") {
   PNG *png;
   png = PNG_open("TEST_output.png", "w");
@@ -3,20 +3,1418 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
 
+/*
+ * Every block starts with a one-word tag: the size of the whole block
+ * (header and payload, always a multiple of ALIGNMENT) with the flags below
+ * in its low bits and the index of the arena that owns the block above bit
+ * ARENA_SHIFT.  The debug build (see ALLOC_DEBUG) adds the canary fields.
+ */
 typedef struct _metadata_t {
-  unsigned int size;     // The size of the memory block.
-  unsigned char isUsed;  // 0 if the block is free; 1 if the block is used.
-  struct _metadata_t *next;  // Pointer to the next metadata_t.
-  struct _metadata_t *prev;  // Pointer to the previous metadata_t.
+  size_t tag;
+#ifdef ALLOC_DEBUG
+  size_t requested;   // Bytes the program asked for.
+  uint64_t canary;    // FRONT_CANARY, right in front of the payload.
+#endif
 } metadata_t;
 
-metadata_t *startOfHeap = NULL;
-metadata_t *endOfHeap = NULL;
-metadata_t *startOfFree = NULL;
-metadata_t *endOfFree = NULL;
+/*
+ * A free block keeps its bin links at the start of its payload (and its
+ * footer at the end), so only free blocks pay for them.
+ */
+typedef struct _links_t {
+  struct _metadata_t *next;  // Pointer to the next free block in the same bin.
+  struct _metadata_t *prev;  // Pointer to the previous free block in the same bin.
+} links_t;
+
+// Set when this block is handed out to the program.
+#define IN_USE 0x1
+// Set when the physically preceding block is in use (or there is none), in
+// which case there is no footer to read in front of this block.
+#define PREV_IN_USE 0x2
+// Set on the last block of a heap segment: the memory after it belongs to
+// someone else (another arena, or whoever else moved the program break).
+#define LAST 0x4
+// Set on a block that has its own anonymous mapping instead of living in an
+// arena; it is returned to the OS with munmap() as soon as it is freed.
+#define MMAPPED 0x8
+#define FLAG_MASK ((size_t)0xF)
+// Set, in the top bit above the arena index, on a block the program freed
+// that stays marked as used (see CACHE_KEY).
+#define CACHED ((size_t)1 << 63)
+#define ARENA_SHIFT 32
+#define SIZE_MASK (((size_t)1 << ARENA_SHIFT) - 1 - FLAG_MASK)
+
+/*
+ * Blocks that the program freed but that stay marked as used (in a thread
+ * cache, a remote-free batch or an arena's tiny list) carry CACHED and are
+ * chained through the first word of their payload, stored XORed with
+ * CACHE_KEY.  CACHED is what tells free() that such a block was freed
+ * already; the link is only ever followed.  Both CACHED and a neighbour's
+ * PREV_IN_USE bit change with atomic operations: a block is cached without
+ * its arena lock, while its PREV_IN_USE bit may be updated under that lock.
+ */
+#define CACHE_KEY ((uintptr_t)0xCAC4ED0B10C4ED00ULL)
+
+/*
+ * Every free block ends with a boundary tag: a footer repeating its size.  A
+ * block whose PREV_IN_USE bit is clear can therefore find the start of its
+ * free predecessor from the footer just in front of it, so free() merges
+ * with both physical neighbours in O(1).  Used blocks need no footer, which
+ * lets the payload run all the way to the next header.
+ */
+typedef size_t footer_t;
+
+/*
+ * Alignment:
+ *
+ * Every payload is ALIGNMENT-aligned, as malloc() must return memory suitable
+ * for any type (long double, SSE vectors).  Blocks (header and payload) span a
+ * whole number of ALIGNMENT units, so with the first header placed
+ * sizeof(metadata_t) before an aligned address, every following payload is
+ * aligned too.  Payload sizes are therefore always MIN_PAYLOAD more than a
+ * multiple of ALIGNMENT.
+ *
+ * Larger alignments (posix_memalign() and friends) are served by allocating
+ * enough to find an aligned address inside the block and giving the space in
+ * front of and behind it back to the arena.
+ */
+#define ALIGNMENT 16
+#define MIN_PAYLOAD ((ALIGNMENT - sizeof(metadata_t) % ALIGNMENT) % ALIGNMENT)
+
+/*
+ * Free blocks are kept in segregated bins instead of one address-ordered list:
+ *
+ * - Small bins hold exactly one size each (8, 24, ..., 1016 bytes), so a small
+ *   request is served by popping the head of its bin in O(1).
+ * - Large bins each cover a power-of-two range of sizes ((1024, 2048], ...)
+ *   and are searched for the best fit within the bin.
+ *
+ * `binMap` has one bit set for every non-empty bin so the next bin that can
+ * satisfy a request is found without walking the empty ones.
+ */
+#define SMALL_BIN_COUNT 64
+#define SMALL_BIN_MAX (SMALL_BIN_COUNT * ALIGNMENT)
+#define LARGE_BIN_COUNT 23
+#define NUM_BINS (SMALL_BIN_COUNT + LARGE_BIN_COUNT)
+#define BINMAP_WORDS ((NUM_BINS + 63) / 64)
+
+/*
+ * A free block needs room for its links and its footer.  Smaller ("tiny")
+ * blocks can only go back into a bin by merging with a free neighbour; one
+ * freed between two used blocks stays marked as used and is kept on its
+ * arena's tiny list for the next request of its size.
+ */
+#define MIN_FREE (sizeof(links_t) + sizeof(footer_t))
+// Smallest block worth splitting off: a header plus the smallest free payload.
+#define MIN_SPLIT (sizeof(metadata_t) + MIN_FREE)
+
+/*
+ * Thread safety:
+ *
+ * - The heap is split into ARENA_COUNT arenas, each with its own bins and its
+ *   own lock.  The first thread uses arena 0; every later thread is assigned
+ *   one of the others round-robin.  Arena 0 grows the heap by exactly what a
+ *   request needs; the others grow by at least ARENA_GROW bytes at a time so
+ *   their segments are not interleaved block by block.
+ * - Each thread keeps a cache of up to TCACHE_COUNT free blocks for every
+ *   size up to TCACHE_MAX.  Cached blocks stay marked as used, so the cache
+ *   is pushed and popped without taking any lock.
+ * - A block freed by a thread that does not use the block's arena is queued
+ *   in that thread's cache and handed back to its arena REMOTE_BATCH blocks
+ *   at a time, under a single acquisition of the arena's lock.
+ */
+#define ARENA_COUNT 8
+#define ARENA_GROW (64 * 1024)
+#define TCACHE_MAX 64
+#define TCACHE_BINS (TCACHE_MAX / ALIGNMENT)
+#define TCACHE_COUNT 16
+#define REMOTE_BATCH 32
+
+/*
+ * Returning memory to the OS:
+ *
+ * - Requests of at least `mmapThreshold` bytes get their own anonymous
+ *   mapping, so freeing (or shrinking) them never leaves a hole in the sbrk
+ *   heap.  Set with the ALLOC_MMAP_THRESHOLD environment variable.
+ * - Once the free block at the program break grows past `trimThreshold`
+ *   bytes, the break is moved back down.  Set with ALLOC_TRIM_THRESHOLD.
+ */
+#define DEFAULT_MMAP_THRESHOLD (128 * 1024)
+#define DEFAULT_TRIM_THRESHOLD (128 * 1024)
+
+/*
+ * Request limits:
+ *
+ * - An arena block's size has to fit in the low 32 bits of its tag, with
+ *   room for an arena to round it up by ARENA_GROW.  Anything larger is
+ *   mapped, whatever `mmapThreshold` says: a mapped block keeps its length
+ *   outside of the tag (see mappingLength()).  Free blocks stop merging
+ *   before they pass it, too (see canMerge()).
+ * - No request over MAX_REQUEST can succeed; refusing them up front keeps
+ *   the size arithmetic from overflowing.
+ */
+#define ARENA_BLOCK_MAX ((size_t)UINT32_MAX - ARENA_GROW)
+#define MAX_REQUEST (SIZE_MAX / 4)
+
+size_t mmapThreshold = DEFAULT_MMAP_THRESHOLD;
+size_t trimThreshold = DEFAULT_TRIM_THRESHOLD;
+size_t pageSize = 4096;
+
+// Lowest and highest address the heap has ever covered; a pointer outside of
+// them can only be a mapped block.
+char *heapLow = NULL;
+char *heapHigh = NULL;
+
+typedef struct _arena_t {
+  pthread_mutex_t lock;
+  unsigned char index;
+  metadata_t *top;   // Last block of the segment this arena is growing.
+  void *topEnd;      // End of that segment (the program break after our last sbrk).
+  char *freshStart;  // Nothing in [freshStart, topEnd) has been written since the kernel zeroed it.
+  metadata_t *freeBins[NUM_BINS];
+  uint64_t binMap[BINMAP_WORDS];
+  metadata_t *tiny;  // Freed tiny blocks, still marked as used (see MIN_FREE).
+} arena_t;
+
+typedef struct _thread_cache_t {
+  metadata_t *bins[TCACHE_BINS];     // Linked with cacheLink().
+  unsigned int counts[TCACHE_BINS];
+  metadata_t *remote[ARENA_COUNT];   // Blocks waiting to go back to other arenas.
+  unsigned int remoteCounts[ARENA_COUNT];
+} thread_cache_t;
+
+arena_t arenas[ARENA_COUNT];
+pthread_mutex_t sbrkLock = PTHREAD_MUTEX_INITIALIZER;
+
+// The first thread's cache is static so it does not show up on the heap.
+thread_cache_t mainCache;
+pthread_key_t cacheKey;
+int initStarted = 0;
+int initDone = 0;
+unsigned int nextArena = 1;
+
+// Thread-local state uses the initial-exec model: dynamic TLS in a dlopen()ed
+// library would be allocated with malloc() on first access.
+static __thread arena_t *threadArena __attribute__((tls_model("initial-exec")));
+static __thread thread_cache_t *tcache __attribute__((tls_model("initial-exec")));
+
+
+/**
+ * Reports a corrupted heap or a bad pointer passed in by the program, then
+ * aborts.  Only write() is used: the heap cannot be trusted any more.
+ */
+static void heapError(const char *message, void *ptr) {
+  char buffer[128];
+  int length = snprintf(buffer, sizeof(buffer), "alloc: %s (%p)\n", message, ptr);
+  if (length > 0) {
+    write(STDERR_FILENO, buffer, (size_t)length < sizeof(buffer) ? (size_t)length : sizeof(buffer) - 1);
+  }
+  abort();
+}
+
+/*
+ * Debug build (-DALLOC_DEBUG, see alloc-debug.so):
+ *
+ * - Every used block gets a canary word on each side of the payload.  The
+ *   front one is the header's `canary` field and the back one sits right
+ *   after the requested bytes, whose count is kept in `requested` (but never
+ *   in the first payload word, which links cached blocks).  Both are checked
+ *   when the block is freed or resized, and by alloc_check_heap().
+ * - Freed payloads are filled with FREED_BYTE to make use-after-free visible.
+ * - alloc_check_heap() walks every segment and every bin and aborts on the
+ *   first inconsistency.  It runs every ALLOC_CHECK_INTERVAL calls (default
+ *   DEFAULT_CHECK_INTERVAL; 0 turns it off) and can be called directly.
+ */
+#ifdef ALLOC_DEBUG
+#define REDZONE sizeof(uint64_t)
+#define FRONT_CANARY 0xFEEDFACECAFEBEEFULL
+#define BACK_CANARY 0xDEADBEEFBAADF00DULL
+#define FREED_BYTE 0xDD
+#define MAX_SEGMENTS 4096
+#define DEFAULT_CHECK_INTERVAL 1024
+
+metadata_t *segments[MAX_SEGMENTS];
+unsigned int segmentCount = 0;
+unsigned long checkInterval = DEFAULT_CHECK_INTERVAL;
+unsigned long checkCalls = 0;
+
+static size_t backCanaryOffset(size_t requested) {
+  return (requested < sizeof(uintptr_t)) ? sizeof(uintptr_t) : requested;
+}
+#else
+static void checkTick() { }
+#endif
+
+/**
+ * Rounds a request up to the next payload size that keeps blocks aligned.
+ */
+static size_t alignSize(size_t size) {
+  size_t block = (sizeof(metadata_t) + size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+  return block - sizeof(metadata_t);
+}
+
+/**
+ * Returns the payload size needed for a request of `size` bytes.
+ */
+static size_t requestSize(size_t size) {
+#ifdef ALLOC_DEBUG
+  return alignSize(backCanaryOffset(size) + REDZONE);
+#else
+  return alignSize(size);
+#endif
+}
+
+// The tag accessors are forced inline: alloc.so is built without optimization
+// and they sit on every path.
+#define ACCESSOR static inline __attribute__((always_inline))
+
+static size_t mappedSize(metadata_t *metadata);
+
+/**
+ * Returns the payload size of `metadata`.
+ */
+ACCESSOR size_t blockSize(metadata_t *metadata) {
+  if (metadata->tag & MMAPPED) {
+    return mappedSize(metadata);
+  }
+  return (metadata->tag & SIZE_MASK) - sizeof(metadata_t);
+}
+
+ACCESSOR void setBlockSize(metadata_t *metadata, size_t size) {
+  metadata->tag = (metadata->tag & ~SIZE_MASK) | (sizeof(metadata_t) + size);
+}
+
+ACCESSOR unsigned int blockArena(metadata_t *metadata) {
+  return (metadata->tag & ~CACHED) >> ARENA_SHIFT;
+}
+
+ACCESSOR void setTag(metadata_t *metadata, size_t size, unsigned int arena, size_t flags) {
+  metadata->tag = (sizeof(metadata_t) + size) | ((size_t)arena << ARENA_SHIFT) | flags;
+}
+
+ACCESSOR links_t *links(metadata_t *metadata) {
+  return (links_t *)((char *)metadata + sizeof(metadata_t));
+}
+
+/**
+ * Reads and writes the link of a block that was freed but is still marked as
+ * used (see CACHE_KEY).
+ */
+ACCESSOR metadata_t *cacheNext(metadata_t *metadata) {
+  return (metadata_t *)(*(uintptr_t *)((char *)metadata + sizeof(metadata_t)) ^ CACHE_KEY);
+}
+
+ACCESSOR void cacheLink(metadata_t *metadata, metadata_t *next) {
+  *(uintptr_t *)((char *)metadata + sizeof(metadata_t)) = (uintptr_t)next ^ CACHE_KEY;
+}
+
+ACCESSOR void setCached(metadata_t *metadata, int cached) {
+  if (cached) {
+    __atomic_fetch_or(&metadata->tag, CACHED, __ATOMIC_RELAXED);
+  } else {
+    __atomic_fetch_and(&metadata->tag, ~CACHED, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Widens [heapLow, heapHigh) to cover [start, end).  Called with sbrkLock held.
+ */
+static void noteHeap(void *start, void *end) {
+  if (heapLow == NULL || (char *)start < heapLow) {
+    heapLow = start;
+  }
+  if ((char *)end > heapHigh) {
+    heapHigh = end;
+  }
+}
+
+/**
+ * Returns the bin index that holds free blocks of `size` bytes.
+ */
+static unsigned int binIndex(size_t size) {
+  if (size <= SMALL_BIN_MAX) {
+    return size / ALIGNMENT;
+  }
+  // (1024, 2048] -> first large bin, (2048, 4096] -> second, ...
+  unsigned int log2 = 63 - __builtin_clzll(size - 1);
+  unsigned int index = SMALL_BIN_COUNT + log2 - 10;
+  return (index < NUM_BINS) ? index : NUM_BINS - 1;
+}
+
+ACCESSOR metadata_t *nextBlock(metadata_t *metadata) {
+  return (metadata_t *)((char *)metadata + (metadata->tag & SIZE_MASK));
+}
+
+/**
+ * Returns the free block physically in front of `metadata`, using its footer.
+ * Only valid when PREV_IN_USE is clear.
+ */
+static metadata_t *prevBlock(metadata_t *metadata) {
+  footer_t prevSize = *((footer_t *)metadata - 1);
+  return (metadata_t *)((char *)metadata - prevSize - sizeof(metadata_t));
+}
+
+/**
+ * Writes the footer of the free block `metadata`.  The last block of a
+ * segment has no successor to read it, so its footer is skipped: this keeps
+ * the fresh memory at the end of a segment untouched.
+ */
+static void writeFooter(metadata_t *metadata) {
+  if (metadata->tag & LAST) {
+    return;
+  }
+  *((footer_t *)nextBlock(metadata) - 1) = blockSize(metadata);
+}
+
+/**
+ * Records in the block after `metadata` whether `metadata` is in use.
+ */
+static void setNextPrevInUse(metadata_t *metadata, int inUse) {
+  if (metadata->tag & LAST) {
+    return;
+  }
+  metadata_t *next = nextBlock(metadata);
+  if (inUse) {
+    __atomic_fetch_or(&next->tag, PREV_IN_USE, __ATOMIC_RELAXED);
+  } else {
+    __atomic_fetch_and(&next->tag, ~PREV_IN_USE, __ATOMIC_RELAXED);
+  }
+}
+
+static void binInsert(arena_t *arena, metadata_t *metadata) {
+  unsigned int index = binIndex(blockSize(metadata));
+  links(metadata)->prev = NULL;
+  links(metadata)->next = arena->freeBins[index];
+  if (arena->freeBins[index] != NULL) {
+    links(arena->freeBins[index])->prev = metadata;
+  }
+  arena->freeBins[index] = metadata;
+  arena->binMap[index / 64] |= (1ULL << (index % 64));
+}
+
+static void binRemove(arena_t *arena, metadata_t *metadata) {
+  unsigned int index = binIndex(blockSize(metadata));
+  links_t *link = links(metadata);
+  if (link->prev != NULL) {
+    links(link->prev)->next = link->next;
+  } else {
+    arena->freeBins[index] = link->next;
+  }
+  if (link->next != NULL) {
+    links(link->next)->prev = link->prev;
+  }
+  if (arena->freeBins[index] == NULL) {
+    arena->binMap[index / 64] &= ~(1ULL << (index % 64));
+  }
+}
+
+/**
+ * Returns the first non-empty bin at or after `index`, or NUM_BINS if every
+ * remaining bin is empty.
+ */
+static unsigned int nextNonEmptyBin(arena_t *arena, unsigned int index) {
+  unsigned int word = index / 64;
+  uint64_t bits = arena->binMap[word] & (~0ULL << (index % 64));
+  while (bits == 0) {
+    if (++word >= BINMAP_WORDS) {
+      return NUM_BINS;
+    }
+    bits = arena->binMap[word];
+  }
+  return word * 64 + __builtin_ctzll(bits);
+}
+
+/**
+ * Finds the smallest free block of at least `size` bytes, or NULL.
+ */
+static metadata_t *findBestFit(arena_t *arena, size_t size) {
+  unsigned int index = nextNonEmptyBin(arena, binIndex(size));
+  while (index < NUM_BINS) {
+    // Every block in a small bin has the same size: take the head.
+    if (index < SMALL_BIN_COUNT) {
+      return arena->freeBins[index];
+    }
+
+    metadata_t *bestFit = NULL;
+    size_t bestSize = 0;
+    for (metadata_t *metadata = arena->freeBins[index]; metadata != NULL; metadata = links(metadata)->next) {
+      size_t blockBytes = blockSize(metadata);
+      if (blockBytes >= size && (bestFit == NULL || blockBytes < bestSize)) {
+        bestFit = metadata;
+        bestSize = blockBytes;
+        if (bestSize == size) { break; }
+      }
+    }
+    if (bestFit != NULL) {
+      return bestFit;
+    }
+    // Only the request's own large bin can hold blocks that are too small.
+    index = nextNonEmptyBin(arena, index + 1);
+  }
+  return NULL;
+}
+
+/**
+ * Returns whether the physically adjacent blocks `first` and `second` fit in
+ * one arena block.  Only blocks past ARENA_BLOCK_MAX together (over 4 GB of
+ * free heap) are ever left side by side unmerged.
+ */
+static int canMerge(metadata_t *first, metadata_t *second) {
+  return blockSize(first) + (second->tag & SIZE_MASK) <= ARENA_BLOCK_MAX;
+}
+
+/**
+ * Merges the block after the free block `metadata` into it, if that one is
+ * free too and the two fit in one block.
+ */
+static void absorbNext(arena_t *arena, metadata_t *metadata) {
+  if (metadata->tag & LAST) {
+    return;
+  }
+  metadata_t *next = nextBlock(metadata);
+  if (!(next->tag & IN_USE) && canMerge(metadata, next)) {
+    binRemove(arena, next);
+    setBlockSize(metadata, blockSize(metadata) + (next->tag & SIZE_MASK));
+    metadata->tag |= (next->tag & LAST);
+    if (next == arena->top) {
+      arena->top = metadata;
+    }
+  }
+}
+
+/**
+ * Marks `metadata` as used and splits off the unused tail into a new free
+ * block when it is large enough to hold one.
+ *
+ * If `clear` is set, the first `size` bytes of the payload are zeroed.  Only
+ * the part below the arena's `freshStart` needs it: memory above it has not
+ * been touched since sbrk() handed it over, and the kernel zeroes new pages.
+ */
+static void *useBlock(arena_t *arena, metadata_t *metadata, size_t size, int clear) {
+  char *payload = (char *)metadata + sizeof(metadata_t);
+  if (clear && arena->freshStart > payload) {
+    size_t dirty = arena->freshStart - payload;
+    memset(payload, 0, (dirty < size) ? dirty : size);
+  }
+
+  metadata->tag |= IN_USE;
+  char *written = (char *)nextBlock(metadata);
+  if (blockSize(metadata) >= size + MIN_SPLIT) {
+    metadata_t *remainder = (metadata_t *)((char *)metadata + sizeof(metadata_t) + size);
+    setTag(remainder, blockSize(metadata) - size - sizeof(metadata_t), arena->index, PREV_IN_USE | (metadata->tag & LAST));
+    metadata->tag &= ~LAST;
+    if (metadata == arena->top) {
+      arena->top = remainder;
+    }
+    setBlockSize(metadata, size);
+    absorbNext(arena, remainder);
+    writeFooter(remainder);
+    binInsert(arena, remainder);
+    // The remainder's links are written too, so they are not fresh memory:
+    written = (char *)remainder + sizeof(metadata_t) + sizeof(links_t);
+  } else {
+    setNextPrevInUse(metadata, 1);
+  }
+  if (written > arena->freshStart) {
+    arena->freshStart = written;
+  }
+  return payload;
+}
+
+/**
+ * Grows `arena` to satisfy a request of `size` bytes.
+ *
+ * When nobody else has moved the program break since the arena last grew,
+ * the arena's segment is extended: a free block at its end grows in place
+ * rather than being stranded.  Otherwise a new segment is started at the
+ * current break.
+ */
+static void *growHeap(arena_t *arena, size_t size, int clear) {
+  pthread_mutex_lock(&sbrkLock);
+  void *brk = sbrk(0);
+  metadata_t *top = arena->top;
+  int contiguous = (top != NULL && brk == arena->topEnd);
+
+  if (contiguous && !(top->tag & IN_USE)) {
+    size_t grow = size - blockSize(top);
+    if (arena->index != 0 && grow < ARENA_GROW) {
+      grow = ARENA_GROW;
+    }
+    if (sbrk(grow) == (void *)-1) {
+      pthread_mutex_unlock(&sbrkLock);
+      return NULL;
+    }
+    arena->topEnd = (char *)brk + grow;
+    noteHeap(brk, arena->topEnd);
+    pthread_mutex_unlock(&sbrkLock);
+
+    binRemove(arena, top);
+    setBlockSize(top, blockSize(top) + grow);
+    return useBlock(arena, top, size, clear);
+  }
+
+  size_t misalignment = ((uintptr_t)brk + sizeof(metadata_t)) % ALIGNMENT;
+  size_t padding = (misalignment != 0) ? ALIGNMENT - misalignment : 0;
+  size_t payload = size;
+  if (arena->index != 0 && payload < ARENA_GROW - sizeof(metadata_t)) {
+    payload = ARENA_GROW - sizeof(metadata_t);
+  }
+  void *start = sbrk(padding + sizeof(metadata_t) + payload);
+  if (start == (void *)-1) {
+    pthread_mutex_unlock(&sbrkLock);
+    return NULL;
+  }
+  metadata_t *metadata = (metadata_t *)((char *)start + padding);
+  arena->topEnd = (char *)metadata + sizeof(metadata_t) + payload;
+  noteHeap(metadata, arena->topEnd);
+  int extends = (contiguous && padding == 0);
+#ifdef ALLOC_DEBUG
+  if (!extends) {
+    if (segmentCount < MAX_SEGMENTS) {
+      segments[segmentCount] = metadata;
+    }
+    segmentCount++;
+  }
+#endif
+  pthread_mutex_unlock(&sbrkLock);
+
+  // Any block before this one in the segment is in use: a free one would
+  // have been extended above instead.
+  if (extends) {
+    top->tag &= ~LAST;
+    if ((char *)metadata + sizeof(metadata_t) > arena->freshStart) {
+      arena->freshStart = (char *)metadata + sizeof(metadata_t);
+    }
+  } else {
+    // The start of a new segment may share a page with memory that someone
+    // else wrote and gave back; only whole pages after it are known zero.
+    uintptr_t pageEnd = ((uintptr_t)start + pageSize - 1) & ~(pageSize - 1);
+    arena->freshStart = (char *)metadata + sizeof(metadata_t);
+    if ((char *)pageEnd > arena->freshStart) {
+      arena->freshStart = (char *)pageEnd;
+    }
+  }
+  setTag(metadata, payload, arena->index, PREV_IN_USE | LAST);
+  arena->top = metadata;
+  return useBlock(arena, metadata, size, clear);
+}
+
+/**
+ * Serves a request from a free block `arena` already has, or returns NULL
+ * rather than growing the heap.
+ */
+static void *arenaReuse(arena_t *arena, size_t size, int clear) {
+  metadata_t *bestFit = findBestFit(arena, size);
+  if (bestFit == NULL) {
+    return NULL;
+  }
+  binRemove(arena, bestFit);
+  return useBlock(arena, bestFit, size, clear);
+}
+
+static void *arenaAllocate(arena_t *arena, size_t size, int clear) {
+  metadata_t *tiny = arena->tiny;
+  if (tiny != NULL && size == blockSize(tiny)) {
+    arena->tiny = cacheNext(tiny);
+    void *ptr = (char *)tiny + sizeof(metadata_t);
+    if (clear) {
+      memset(ptr, 0, size);
+    }
+    return ptr;
+  }
+
+  void *ptr = arenaReuse(arena, size, clear);
+  return (ptr != NULL) ? ptr : growHeap(arena, size, clear);
+}
+
+/**
+ * Frees `metadata` back into `arena`, merging it with whichever physical
+ * neighbours are free so that no two free blocks are ever adjacent (as long
+ * as they can merge).
+ */
+static void arenaRelease(arena_t *arena, metadata_t *metadata) {
+  int mergePrev = !(metadata->tag & PREV_IN_USE) && canMerge(prevBlock(metadata), metadata);
+  if (blockSize(metadata) < MIN_FREE && !mergePrev &&
+      ((metadata->tag & LAST) || (nextBlock(metadata)->tag & IN_USE) || !canMerge(metadata, nextBlock(metadata)))) {
+    cacheLink(metadata, arena->tiny);
+    setCached(metadata, 1);
+    arena->tiny = metadata;
+    return;
+  }
+  metadata->tag &= ~(IN_USE | CACHED);
+
+  if (mergePrev) {
+    metadata_t *prev = prevBlock(metadata);
+    binRemove(arena, prev);
+    setBlockSize(prev, blockSize(prev) + (metadata->tag & SIZE_MASK));
+    prev->tag |= (metadata->tag & LAST);
+    if (metadata == arena->top) {
+      arena->top = prev;
+    }
+    metadata = prev;
+  }
+
+  absorbNext(arena, metadata);
+  writeFooter(metadata);
+  setNextPrevInUse(metadata, 0);
+  binInsert(arena, metadata);
+}
+
+/**
+ * Gives the free space at the end of `arena`'s segment back to the OS once
+ * it passes `trimThreshold`, as long as the segment still ends at the
+ * program break.
+ */
+static void trimTop(arena_t *arena) {
+  metadata_t *top = arena->top;
+  if (top == NULL || (top->tag & IN_USE) || blockSize(top) <= trimThreshold) {
+    return;
+  }
+
+  pthread_mutex_lock(&sbrkLock);
+  if (sbrk(0) == arena->topEnd) {
+    size_t shrink = blockSize(top) - MIN_FREE;
+    if (sbrk(-(intptr_t)shrink) != (void *)-1) {
+      // Pages handed back are not guaranteed to be zero when the break grows
+      // over them again (the partial page at the new break keeps its data).
+      if ((char *)arena->topEnd > arena->freshStart) {
+        arena->freshStart = arena->topEnd;
+      }
+      binRemove(arena, top);
+      setBlockSize(top, MIN_FREE);
+      arena->topEnd = (char *)arena->topEnd - shrink;
+      writeFooter(top);
+      binInsert(arena, top);
+    }
+  }
+  pthread_mutex_unlock(&sbrkLock);
+
+  // A free block left in front of the top because the two did not fit in one
+  // block (see canMerge()) can take the top's place now, and be trimmed too.
+  top = arena->top;
+  if (blockSize(top) == MIN_FREE && !(top->tag & PREV_IN_USE) && canMerge(prevBlock(top), top)) {
+    metadata_t *prev = prevBlock(top);
+    binRemove(arena, prev);
+    binRemove(arena, top);
+    setBlockSize(prev, blockSize(prev) + (top->tag & SIZE_MASK));
+    prev->tag |= LAST;
+    arena->top = prev;
+    binInsert(arena, prev);
+    trimTop(arena);
+  }
+}
+
+/**
+ * Shrinks the used block `metadata` to `size` bytes in place, returning its
+ * tail to `arena` (merged with the next block if that one is free).
+ */
+static void shrinkInPlace(arena_t *arena, metadata_t *metadata, size_t size) {
+  metadata_t *tail = (metadata_t *)((char *)metadata + sizeof(metadata_t) + size);
+  setTag(tail, blockSize(metadata) - size - sizeof(metadata_t), blockArena(metadata),
+         IN_USE | PREV_IN_USE | (metadata->tag & LAST));
+  metadata->tag &= ~LAST;
+  if (metadata == arena->top) {
+    arena->top = tail;
+  }
+  setBlockSize(metadata, size);
+  arenaRelease(arena, tail);
+  trimTop(arena);
+}
+
+/**
+ * Tries to grow the used block `metadata` to `size` bytes without moving it:
+ * first into the next block if that one is free, and then, when the block
+ * (or that free neighbour) ends the arena's segment at the program break,
+ * by moving the break.  Returns NULL if the block has to move.
+ */
+static void *growInPlace(arena_t *arena, metadata_t *metadata, size_t size) {
+  size_t available = blockSize(metadata);
+  metadata_t *next = NULL;
+  if (!(metadata->tag & LAST)) {
+    next = nextBlock(metadata);
+    if ((next->tag & IN_USE) || !canMerge(metadata, next)) {
+      return NULL;
+    }
+    available += next->tag & SIZE_MASK;
+  }
+
+  if (available < size) {
+    if (((next != NULL) ? next : metadata) != arena->top) {
+      return NULL;
+    }
+    pthread_mutex_lock(&sbrkLock);
+    if (sbrk(0) != arena->topEnd || sbrk(size - available) == (void *)-1) {
+      pthread_mutex_unlock(&sbrkLock);
+      return NULL;
+    }
+    arena->topEnd = (char *)arena->topEnd + (size - available);
+    noteHeap(metadata, arena->topEnd);
+    pthread_mutex_unlock(&sbrkLock);
+    available = size;
+  }
+
+  if (next != NULL) {
+    binRemove(arena, next);
+    metadata->tag |= (next->tag & LAST);
+    if (next == arena->top) {
+      arena->top = metadata;
+    }
+  }
+  setBlockSize(metadata, available);
+  return useBlock(arena, metadata, size, 0);
+}
+
+/**
+ * Moves the used block at `ptr` forward to the first multiple of `alignment`
+ * that leaves room for a free block in front of it, and gives that space,
+ * and anything past `size` bytes, back to `arena`.
+ */
+static void *carveAligned(arena_t *arena, void *ptr, size_t alignment, size_t size) {
+  metadata_t *metadata = (metadata_t *)((char *)ptr - sizeof(metadata_t));
+  uintptr_t payload = ((uintptr_t)ptr + alignment - 1) & ~(uintptr_t)(alignment - 1);
+  if (payload != (uintptr_t)ptr && payload - (uintptr_t)ptr < MIN_SPLIT) {
+    payload += alignment;
+  }
+
+  if (payload != (uintptr_t)ptr) {
+    size_t lead = payload - (uintptr_t)ptr;
+    metadata_t *aligned = (metadata_t *)(payload - sizeof(metadata_t));
+    setTag(aligned, blockSize(metadata) - lead, arena->index, IN_USE | (metadata->tag & LAST));
+    metadata->tag &= ~LAST;
+    if (metadata == arena->top) {
+      arena->top = aligned;
+    }
+    setBlockSize(metadata, lead - sizeof(metadata_t));
+    arenaRelease(arena, metadata);
+    metadata = aligned;
+  }
+  if (blockSize(metadata) - size >= MIN_SPLIT) {
+    shrinkInPlace(arena, metadata, size);
+  }
+  return (void *)payload;
+}
+
+static size_t pageRound(size_t size) {
+  return (size + pageSize - 1) & ~(pageSize - 1);
+}
+
+/*
+ * A mapped block's header lies in the first page of its mapping, as far in
+ * as its payload's alignment needs, right after a word holding the length of
+ * the mapping.  Its tag holds only the flags: the block runs to the last
+ * multiple of ALIGNMENT before the end of the mapping, which may be further
+ * than the tag's 32 bits of size could reach.
+ */
+static char *mappingStart(metadata_t *metadata) {
+  return (char *)((uintptr_t)metadata & ~(uintptr_t)(pageSize - 1));
+}
+
+static size_t mappingLength(metadata_t *metadata) {
+  return *((size_t *)metadata - 1);
+}
+
+static void setMappingLength(metadata_t *metadata, size_t length) {
+  *((size_t *)metadata - 1) = length;
+}
+
+/**
+ * Returns the payload size of the mapped block at `metadata`.
+ */
+static size_t mappedSize(metadata_t *metadata) {
+  char *end = mappingStart(metadata) + mappingLength(metadata);
+  return ((end - (char *)metadata) & ~(size_t)(ALIGNMENT - 1)) - sizeof(metadata_t);
+}
+
+/**
+ * Serves a large request from its own anonymous mapping, with the payload
+ * aligned to `alignment` bytes.
+ */
+static void *mmapAllocate(size_t size, size_t alignment) {
+  size_t length = pageRound(sizeof(size_t) + sizeof(metadata_t) + size + alignment);
+  char *mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    return NULL;
+  }
+  uintptr_t payload = ((uintptr_t)mapping + sizeof(size_t) + sizeof(metadata_t) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+  metadata_t *metadata = (metadata_t *)(payload - sizeof(metadata_t));
+  char *start = mappingStart(metadata);
+  char *end = (char *)pageRound(payload + size);
+  // Only alignments past a page leave whole pages unused on either side:
+  if (start > mapping) {
+    munmap(mapping, start - mapping);
+  }
+  if (end < mapping + length) {
+    munmap(end, mapping + length - end);
+  }
+
+  metadata->tag = IN_USE | MMAPPED;
+  setMappingLength(metadata, end - start);
+  return (void *)payload;
+}
+
+/**
+ * Resizes a mapped block, letting the kernel move its pages rather than
+ * copying them.
+ */
+static void *mmapReallocate(metadata_t *metadata, size_t size) {
+  char *start = mappingStart(metadata);
+  size_t offset = (char *)metadata - start;
+  size_t oldLength = mappingLength(metadata);
+  size_t length = pageRound(offset + sizeof(metadata_t) + size);
+  if (length == oldLength) {
+    return (void *)metadata + sizeof(metadata_t);
+  }
+#ifdef MREMAP_MAYMOVE
+  char *moved = mremap(start, oldLength, length, MREMAP_MAYMOVE);
+  if (moved == MAP_FAILED) {
+    return NULL;
+  }
+  metadata = (metadata_t *)(moved + offset);
+  setMappingLength(metadata, length);
+  return (void *)metadata + sizeof(metadata_t);
+#else
+  void *ptr = mmapAllocate(size, ALIGNMENT);
+  if (ptr != NULL) {
+    memcpy(ptr, (void *)metadata + sizeof(metadata_t), (blockSize(metadata) < size) ? blockSize(metadata) : size);
+    munmap(start, oldLength);
+  }
+  return ptr;
+#endif
+}
+
+/**
+ * Reads a size from the environment variable `name`, or returns `fallback`.
+ */
+static size_t sizeFromEnv(const char *name, size_t fallback) {
+  const char *value = getenv(name);
+  if (value == NULL || *value == '\0') {
+    return fallback;
+  }
+  return strtoul(value, NULL, 0);
+}
+
+/**
+ * Returns every block on the list starting at `metadata` (linked with
+ * cacheLink()) to `arena` under a single lock acquisition.
+ */
+static void arenaReleaseList(arena_t *arena, metadata_t *metadata) {
+  pthread_mutex_lock(&arena->lock);
+  while (metadata != NULL) {
+    metadata_t *next = cacheNext(metadata);
+    arenaRelease(arena, metadata);
+    metadata = next;
+  }
+  trimTop(arena);
+  pthread_mutex_unlock(&arena->lock);
+}
+
+/**
+ * Empties the calling thread's cache and remote-free batches when it exits.
+ */
+static void threadExit(void *cache) {
+  thread_cache_t *threadCache = cache;
+  arena_t *arena = threadArena;
+  tcache = NULL;
+
+  for (unsigned int i = 0; i < TCACHE_BINS; i++) {
+    arenaReleaseList(arena, threadCache->bins[i]);
+  }
+  for (unsigned int i = 0; i < ARENA_COUNT; i++) {
+    arenaReleaseList(&arenas[i], threadCache->remote[i]);
+  }
+  if (threadCache != &mainCache) {
+    pthread_mutex_lock(&arena->lock);
+    arenaRelease(arena, (metadata_t *)((char *)threadCache - sizeof(metadata_t)));
+    pthread_mutex_unlock(&arena->lock);
+  }
+}
+
+/*
+ * fork() handlers: hold every lock across the fork so the child never
+ * inherits a lock taken by a thread that does not exist in the child.  Arena
+ * locks are always taken before sbrkLock.
+ */
+static void forkPrepare() {
+  for (unsigned int i = 0; i < ARENA_COUNT; i++) {
+    pthread_mutex_lock(&arenas[i].lock);
+  }
+  pthread_mutex_lock(&sbrkLock);
+}
+
+static void forkParent() {
+  pthread_mutex_unlock(&sbrkLock);
+  for (unsigned int i = 0; i < ARENA_COUNT; i++) {
+    pthread_mutex_unlock(&arenas[i].lock);
+  }
+}
+
+static void forkChild() {
+  for (unsigned int i = 0; i < ARENA_COUNT; i++) {
+    pthread_mutex_init(&arenas[i].lock, NULL);
+  }
+  pthread_mutex_init(&sbrkLock, NULL);
+}
+
+#ifdef ALLOC_DEBUG
+/**
+ * Puts the canaries around the `size` requested bytes at `ptr` as it is
+ * handed out.  Called with an arena lock held, so alloc_check_heap() never
+ * sees a block half-armed.
+ */
+static void armBlock(void *ptr, size_t size) {
+  metadata_t *metadata = (metadata_t *)((char *)ptr - sizeof(metadata_t));
+  uint64_t canary = BACK_CANARY;
+  metadata->requested = size;
+  memcpy((char *)ptr + backCanaryOffset(size), &canary, sizeof(canary));
+  metadata->canary = FRONT_CANARY;
+}
+
+/**
+ * Returns what is wrong with the canaries of the used block `metadata`, or
+ * NULL if they are intact.
+ */
+static const char *canaryProblem(metadata_t *metadata) {
+  char *payload = (char *)metadata + sizeof(metadata_t);
+  size_t offset = backCanaryOffset(metadata->requested);
+  uint64_t canary;
+  if (metadata->canary != FRONT_CANARY) {
+    return "front canary overwritten (buffer underflow?)";
+  }
+  if (offset + REDZONE > blockSize(metadata)) {
+    return "block header overwritten";
+  }
+  memcpy(&canary, payload + offset, sizeof(canary));
+  if (canary != BACK_CANARY) {
+    return "back canary overwritten (buffer overflow?)";
+  }
+  return NULL;
+}
+
+int alloc_check_heap();
+
+/**
+ * Runs alloc_check_heap() every `checkInterval` calls.
+ */
+static void checkTick() {
+  if (checkInterval != 0 && __atomic_add_fetch(&checkCalls, 1, __ATOMIC_RELAXED) % checkInterval == 0) {
+    alloc_check_heap();
+  }
+}
+
+/**
+ * Walks every segment block by block and every bin node by node, aborting
+ * with a description of the first inconsistency found.  Returns 0 otherwise.
+ */
+int alloc_check_heap() {
+  for (unsigned int i = 0; i < ARENA_COUNT; i++) {
+    pthread_mutex_lock(&arenas[i].lock);
+  }
+  pthread_mutex_lock(&sbrkLock);
+
+  size_t freeBlocks[ARENA_COUNT] = { 0 };
+  size_t tinyBlocks[ARENA_COUNT] = { 0 };
+  unsigned int walked = (segmentCount < MAX_SEGMENTS) ? segmentCount : MAX_SEGMENTS;
+  int complete = (segmentCount <= MAX_SEGMENTS);
+
+  for (unsigned int s = 0; s < walked; s++) {
+    unsigned int arena = blockArena(segments[s]);
+    if (arena >= ARENA_COUNT) {
+      heapError("segment has an invalid arena", segments[s]);
+    }
+    int prevInUse = 1;
+    metadata_t *prev = NULL;
+    for (metadata_t *metadata = segments[s]; ; metadata = nextBlock(metadata)) {
+      if ((char *)metadata < heapLow || (char *)metadata + sizeof(metadata_t) > heapHigh) {
+        heapError("block outside of the heap", metadata);
+      }
+      if ((metadata->tag & MMAPPED) || blockArena(metadata) != arena) {
+        heapError("block header overwritten", metadata);
+      }
+      if ((metadata->tag & SIZE_MASK) < sizeof(metadata_t) + MIN_PAYLOAD || (char *)nextBlock(metadata) > heapHigh) {
+        heapError("block has an invalid size", metadata);
+      }
+      if (!(metadata->tag & PREV_IN_USE) != !prevInUse) {
+        heapError("PREV_IN_USE does not match the previous block", metadata);
+      }
+
+      if (metadata->tag & IN_USE) {
+        const char *problem = canaryProblem(metadata);
+        if (problem != NULL) {
+          heapError(problem, (char *)metadata + sizeof(metadata_t));
+        }
+        if (blockSize(metadata) < MIN_FREE) {
+          tinyBlocks[arena]++;
+        }
+      } else {
+        if (!prevInUse && canMerge(prev, metadata)) {
+          heapError("two adjacent free blocks", metadata);
+        }
+        if (blockSize(metadata) < MIN_FREE) {
+          heapError("free block too small for its links", metadata);
+        }
+        if (!(metadata->tag & LAST) && *((footer_t *)nextBlock(metadata) - 1) != blockSize(metadata)) {
+          heapError("footer does not match the block size", metadata);
+        }
+        freeBlocks[arena]++;
+      }
+
+      if (metadata->tag & LAST) {
+        break;
+      }
+      prevInUse = (metadata->tag & IN_USE) != 0;
+      prev = metadata;
+    }
+  }
+
+  for (unsigned int a = 0; a < ARENA_COUNT; a++) {
+    arena_t *arena = &arenas[a];
+    size_t binned = 0;
+    for (unsigned int i = 0; i < NUM_BINS; i++) {
+      int mapped = (arena->binMap[i / 64] >> (i % 64)) & 1;
+      if (mapped != (arena->freeBins[i] != NULL)) {
+        heapError("binMap does not match the bins", arena->freeBins[i]);
+      }
+      metadata_t *prev = NULL;
+      for (metadata_t *metadata = arena->freeBins[i]; metadata != NULL; metadata = links(metadata)->next) {
+        if ((char *)metadata < heapLow || (char *)metadata >= heapHigh) {
+          heapError("bin links outside of the heap", metadata);
+        }
+        if ((metadata->tag & IN_USE) || blockArena(metadata) != a) {
+          heapError("used or foreign block in a bin", metadata);
+        }
+        if (binIndex(blockSize(metadata)) != i) {
+          heapError("block in the wrong bin", metadata);
+        }
+        if (links(metadata)->prev != prev) {
+          heapError("bin prev link does not match", metadata);
+        }
+        if (complete && ++binned > freeBlocks[a]) {
+          heapError("more blocks in the bins than free in the heap (cycle?)", metadata);
+        }
+        prev = metadata;
+      }
+    }
+    if (complete && binned != freeBlocks[a]) {
+      heapError("free block missing from the bins", arena);
+    }
+
+    size_t tiny = 0;
+    for (metadata_t *metadata = arena->tiny; metadata != NULL; metadata = cacheNext(metadata)) {
+      if ((char *)metadata < heapLow || (char *)metadata >= heapHigh) {
+        heapError("tiny list links outside of the heap", metadata);
+      }
+      if ((metadata->tag & (IN_USE | CACHED)) != (IN_USE | CACHED) || blockArena(metadata) != a ||
+          blockSize(metadata) >= MIN_FREE) {
+        heapError("free, foreign or large block in a tiny list", metadata);
+      }
+      if (complete && ++tiny > tinyBlocks[a]) {
+        heapError("more blocks in the tiny list than in the heap (cycle?)", metadata);
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&sbrkLock);
+  for (unsigned int i = 0; i < ARENA_COUNT; i++) {
+    pthread_mutex_unlock(&arenas[i].lock);
+  }
+  return 0;
+}
+#endif
+
+#ifndef ALLOC_DEBUG
+static void armBlock(void *ptr, size_t size) { }
+#endif
+
+/**
+ * Hands the used block at `ptr` out for a request of `size` bytes: takes it
+ * off the cached blocks (see CACHE_KEY) and arms the canaries.
+ */
+static void *handOut(void *ptr, size_t size) {
+  metadata_t *metadata = (metadata_t *)((char *)ptr - sizeof(metadata_t));
+  if (metadata->tag & CACHED) {
+    setCached(metadata, 0);
+  }
+  armBlock(ptr, size);
+  return ptr;
+}
+
+/**
+ * Returns how many bytes at `metadata`'s payload belong to the program.
+ */
+static size_t usableSize(metadata_t *metadata) {
+#ifdef ALLOC_DEBUG
+  return metadata->requested;
+#else
+  return blockSize(metadata);
+#endif
+}
+
+/**
+ * Returns the header of the block `ptr` handed to free() or realloc(), after
+ * cheap checks that it is a block this allocator handed out and that it has
+ * not been freed already.
+ */
+static metadata_t *checkedBlock(void *ptr) {
+  metadata_t *metadata = (metadata_t *)((char *)ptr - sizeof(metadata_t));
+  if ((uintptr_t)ptr % ALIGNMENT != 0) {
+    heapError("invalid pointer", ptr);
+  }
+  // Only a mapped block lives outside the heap.
+  int outside = ((char *)metadata < heapLow || (char *)ptr >= heapHigh);
+  size_t tag = metadata->tag;
+  size_t flags = tag & FLAG_MASK;
+  if ((outside || (flags & MMAPPED)) && tag != (IN_USE | MMAPPED)) {
+    heapError("invalid pointer", ptr);
+  }
+  if ((flags & MMAPPED) ? (mappingLength(metadata) == 0 || mappingLength(metadata) % pageSize != 0)
+                        : (((tag & ~CACHED) >> ARENA_SHIFT) >= ARENA_COUNT || (tag & SIZE_MASK) < sizeof(metadata_t) + MIN_PAYLOAD)) {
+    heapError("invalid pointer", ptr);
+  }
+  if (!(flags & IN_USE) || (tag & CACHED)) {
+    heapError("block is not in use (double free?)", ptr);
+  }
+#ifdef ALLOC_DEBUG
+  const char *problem = canaryProblem(metadata);
+  if (problem != NULL) {
+    heapError(problem, ptr);
+  }
+#endif
+  return metadata;
+}
+
+/**
+ * Assigns the calling thread an arena and a cache.  The first caller also
+ * sets up the allocator itself.
+ */
+static arena_t *setupThread() {
+  if (__atomic_exchange_n(&initStarted, 1, __ATOMIC_ACQ_REL) == 0) {
+    for (unsigned int i = 0; i < ARENA_COUNT; i++) {
+      pthread_mutex_init(&arenas[i].lock, NULL);
+      arenas[i].index = i;
+    }
+    pageSize = sysconf(_SC_PAGESIZE);
+    mmapThreshold = sizeFromEnv("ALLOC_MMAP_THRESHOLD", DEFAULT_MMAP_THRESHOLD);
+    trimThreshold = sizeFromEnv("ALLOC_TRIM_THRESHOLD", DEFAULT_TRIM_THRESHOLD);
+#ifdef ALLOC_DEBUG
+    checkInterval = sizeFromEnv("ALLOC_CHECK_INTERVAL", DEFAULT_CHECK_INTERVAL);
+#endif
+    threadArena = &arenas[0];
+    tcache = &mainCache;
+    // Both of these may allocate, which is safe now that the thread is set up.
+    pthread_key_create(&cacheKey, threadExit);
+    pthread_setspecific(cacheKey, tcache);
+    pthread_atfork(forkPrepare, forkParent, forkChild);
+    __atomic_store_n(&initDone, 1, __ATOMIC_RELEASE);
+    return threadArena;
+  }
+
+  while (!__atomic_load_n(&initDone, __ATOMIC_ACQUIRE)) {
+    sched_yield();
+  }
+  unsigned int index = __atomic_fetch_add(&nextArena, 1, __ATOMIC_RELAXED) % ARENA_COUNT;
+  arena_t *arena = &arenas[index];
+  threadArena = arena;
+
+  pthread_mutex_lock(&arena->lock);
+  thread_cache_t *cache = arenaAllocate(arena, requestSize(sizeof(thread_cache_t)), 0);
+  if (cache != NULL) {
+    handOut(cache, sizeof(thread_cache_t));
+  }
+  pthread_mutex_unlock(&arena->lock);
+  if (cache != NULL) {
+    memset(cache, 0, sizeof(thread_cache_t));
+    tcache = cache;
+    pthread_setspecific(cacheKey, cache);
+  }
+  return arena;
+}
+
+/**
+ * Allocates `size` bytes; with `clear` set the memory is also zeroed, which
+ * is skipped wherever the memory is known to be fresh from the kernel.
+ */
+static void *allocate(size_t size, int clear) {
+  checkTick();
+  if (size > MAX_REQUEST) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  size_t aligned = requestSize(size);
+
+  arena_t *arena = threadArena;
+  if (arena == NULL) {
+    arena = setupThread();
+  }
+  if (aligned >= mmapThreshold || aligned > ARENA_BLOCK_MAX) {
+    // A free block the arena already has beats a new mapping:
+    if (aligned <= ARENA_BLOCK_MAX) {
+      pthread_mutex_lock(&arena->lock);
+      void *ptr = arenaReuse(arena, aligned, clear);
+      if (ptr != NULL) {
+        handOut(ptr, size);
+      }
+      pthread_mutex_unlock(&arena->lock);
+      if (ptr != NULL) {
+        return ptr;
+      }
+    }
+    // Anonymous mappings always start out zeroed.
+    void *ptr = mmapAllocate(aligned, ALIGNMENT);
+    if (ptr == NULL) {
+      errno = ENOMEM;
+      return NULL;
+    }
+    armBlock(ptr, size);
+    return ptr;
+  }
+
+  thread_cache_t *cache = tcache;
+  if (cache != NULL && aligned <= TCACHE_MAX) {
+    unsigned int index = aligned / ALIGNMENT;
+    metadata_t *metadata = cache->bins[index];
+    if (metadata != NULL) {
+      cache->bins[index] = cacheNext(metadata);
+      cache->counts[index]--;
+      void *ptr = (void *)metadata + sizeof(metadata_t);
+#ifdef ALLOC_DEBUG
+      // Any arena lock keeps alloc_check_heap() out while calloc() wipes the
+      // old back canary and the block is armed again.
+      pthread_mutex_lock(&arena->lock);
+#endif
+      if (clear) {
+        memset(ptr, 0, aligned);
+      }
+      handOut(ptr, size);
+#ifdef ALLOC_DEBUG
+      pthread_mutex_unlock(&arena->lock);
+#endif
+      return ptr;
+    }
+  }
+
+  // Blocks are armed before the lock is dropped so alloc_check_heap() never
+  // sees a used block without its canaries.
+  pthread_mutex_lock(&arena->lock);
+  void *ptr = arenaAllocate(arena, aligned, clear);
+  if (ptr != NULL) {
+    handOut(ptr, size);
+  }
+  pthread_mutex_unlock(&arena->lock);
+  if (ptr == NULL) {
+    errno = ENOMEM;
+  }
+  return ptr;
+}
+
+/**
+ * Allocates `size` bytes at a multiple of `alignment`, a power of two.
+ */
+static void *allocateAligned(size_t alignment, size_t size) {
+  if (alignment <= ALIGNMENT) {
+    return allocate(size, 0);
+  }
+  checkTick();
+  if (alignment > MAX_REQUEST || size > MAX_REQUEST) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  size_t aligned = requestSize(size);
+
+  arena_t *arena = threadArena;
+  if (arena == NULL) {
+    arena = setupThread();
+  }
+  if (aligned >= mmapThreshold || aligned + alignment + MIN_SPLIT > ARENA_BLOCK_MAX) {
+    if (aligned + alignment + MIN_SPLIT <= ARENA_BLOCK_MAX) {
+      pthread_mutex_lock(&arena->lock);
+      void *ptr = arenaReuse(arena, aligned + alignment + MIN_SPLIT, 0);
+      if (ptr != NULL) {
+        ptr = handOut(carveAligned(arena, ptr, alignment, aligned), size);
+      }
+      pthread_mutex_unlock(&arena->lock);
+      if (ptr != NULL) {
+        return ptr;
+      }
+    }
+    void *ptr = mmapAllocate(aligned, alignment);
+    if (ptr == NULL) {
+      errno = ENOMEM;
+      return NULL;
+    }
+    armBlock(ptr, size);
+    return ptr;
+  }
+
+  // Enough room to find an aligned payload with a free block in front of it:
+  pthread_mutex_lock(&arena->lock);
+  void *ptr = arenaAllocate(arena, aligned + alignment + MIN_SPLIT, 0);
+  if (ptr != NULL) {
+    ptr = handOut(carveAligned(arena, ptr, alignment, aligned), size);
+  }
+  pthread_mutex_unlock(&arena->lock);
+  if (ptr == NULL) {
+    errno = ENOMEM;
+  }
+  return ptr;
+}
+
+static void release(void *ptr) {
+  checkTick();
+  metadata_t *metadata = checkedBlock(ptr);
+#ifdef ALLOC_DEBUG
+  if (!(metadata->tag & MMAPPED)) {
+    memset(ptr, FREED_BYTE, usableSize(metadata));
+  }
+#endif
+  if (metadata->tag & MMAPPED) {
+    munmap(mappingStart(metadata), mappingLength(metadata));
+    return;
+  }
+
+  arena_t *owner = &arenas[blockArena(metadata)];
+  if (threadArena == NULL) {
+    setupThread();
+  }
+  thread_cache_t *cache = tcache;
+
+  if (cache != NULL && owner != threadArena) {
+    cacheLink(metadata, cache->remote[owner->index]);
+    setCached(metadata, 1);
+    cache->remote[owner->index] = metadata;
+    if (++cache->remoteCounts[owner->index] >= REMOTE_BATCH) {
+      arenaReleaseList(owner, cache->remote[owner->index]);
+      cache->remote[owner->index] = NULL;
+      cache->remoteCounts[owner->index] = 0;
+    }
+    return;
+  }
+
+  size_t size = blockSize(metadata);
+  if (cache != NULL && size <= TCACHE_MAX) {
+    unsigned int index = size / ALIGNMENT;
+    if (cache->counts[index] < TCACHE_COUNT) {
+      cacheLink(metadata, cache->bins[index]);
+      setCached(metadata, 1);
+      cache->bins[index] = metadata;
+      cache->counts[index]++;
+      return;
+    }
+  }
+
+  pthread_mutex_lock(&owner->lock);
+  arenaRelease(owner, metadata);
+  trimTop(owner);
+  pthread_mutex_unlock(&owner->lock);
+}
+
 
 
 /**
@@ -44,11 +1442,12 @@ metadata_t *endOfFree = NULL;
  */
 void *calloc(size_t num, size_t size) {
   // implement calloc:
-  void *ptr = malloc(num * size);
-  if (ptr) {
-    memset(ptr, 0, num * size);
+  size_t total;
+  if (__builtin_mul_overflow(num, size, &total)) {
+    errno = ENOMEM;
+    return NULL;
   }
-  return ptr;
+  return allocate(total, 1);
 }
 
 /**
@@ -73,65 +1472,7 @@ void *calloc(size_t num, size_t size) {
  * @see http://www.cplusplus.com/reference/clibrary/cstdlib/malloc/
  */
 void *malloc(size_t size) {
-  if (startOfHeap == NULL) {
-    metadata_t *metadata = sbrk(sizeof(metadata_t));
-    metadata->size = size;
-    metadata->isUsed = 1;
-    metadata->next = NULL;
-    metadata->prev = NULL;
-    startOfHeap = metadata;
-    endOfHeap = metadata;
-    void *ptr = (void *)metadata + sizeof(metadata_t);
-    ptr = sbrk(size);
-    return ptr;
-  }
-  metadata_t *bestFit = NULL;
-  metadata_t *metadata = startOfFree;
-  while (metadata != NULL) {
-    if (metadata->size >= size) {
-      if (bestFit == NULL || metadata->size < bestFit->size) {
-        bestFit = metadata;
-      }
-    }
-    metadata = metadata->next;
-  }
-  if (bestFit == NULL) {
-    metadata_t *metadata = sbrk(sizeof(metadata_t));
-    metadata->size = size;
-    metadata->isUsed = 1;
-    endOfHeap = metadata;
-    metadata->next = NULL;
-    metadata->prev = NULL;
-    void *ptr = (void *)metadata + sizeof(metadata_t);
-    ptr = sbrk(size);
-    return ptr;
-  }
-  if (bestFit->size > size + sizeof(metadata_t)) {
-    metadata_t *newMetadata = (metadata_t *)((char *)bestFit + sizeof(metadata_t) + size);
-    newMetadata->size = bestFit->size - sizeof(metadata_t) - size;
-    newMetadata->isUsed = 0;
-    newMetadata->next = bestFit->next;
-    if (bestFit->next != NULL) {
-      bestFit->next->prev = newMetadata;
-    } else {
-      endOfFree = newMetadata;
-    }
-    newMetadata->prev = bestFit->prev;
-    if (bestFit->prev != NULL) {
-      bestFit->prev->next = newMetadata;
-    } else {
-      startOfFree = newMetadata;
-    }
-    if (bestFit == endOfHeap) {
-      endOfHeap = newMetadata;
-    }
-    bestFit->size = size;
-  }
-  bestFit->isUsed = 1;
-  bestFit->next = NULL;
-  bestFit->prev = NULL;
-  void *ptr = (void *)bestFit + sizeof(metadata_t);
-  return ptr;
+  return allocate(size, 0);
 }
 
 
@@ -152,58 +1493,10 @@ void *malloc(size_t size) {
  *    passed as argument, no action occurs.
  */
 void free(void *ptr) {
-  metadata_t *metadata = (metadata_t*)((char*)ptr - sizeof(metadata_t));
-  metadata->isUsed = 0;
-  if (startOfFree == NULL) {
-    startOfFree = metadata;
-    endOfFree = metadata;
-    metadata->next = NULL;
-    metadata->prev = NULL;
-  } else if (metadata < startOfFree) {
-    metadata->next = startOfFree;
-    metadata->prev = NULL;
-    startOfFree->prev = metadata;
-    startOfFree = metadata;
-  } else if (metadata > endOfFree) {
-    metadata->next = NULL;
-    metadata->prev = endOfFree;
-    endOfFree->next = metadata;
-    endOfFree = metadata;
-  } else {
-    metadata_t *current = startOfFree;
-    while (current != NULL) {
-      if (metadata < current) {
-        metadata->next = current;
-        metadata->prev = current->prev;
-        current->prev->next = metadata;
-        current->prev = metadata;
-        break;
-      }
-      current = current->next;
-    }
-  }
-  if (startOfFree != NULL && metadata != endOfHeap && metadata != endOfFree) {  
-    if (metadata == (void*)metadata->next - metadata->size - sizeof(metadata_t)) {
-      metadata->size += metadata->next->size + sizeof(metadata_t);
-      metadata->next = metadata->next->next;
-      if (metadata->next != NULL) {
-        metadata->next->prev = metadata;
-      } else {
-        endOfFree = metadata;
-      }
-    }
-  }
-  if (startOfFree != NULL && metadata != startOfHeap && metadata != startOfFree) {
-    if (metadata->prev == (void*)metadata - metadata->prev->size - sizeof(metadata_t)) {
-      metadata->prev->size += metadata->size + sizeof(metadata_t);
-      metadata->prev->next = metadata->next;
-      if (metadata->next != NULL) {
-        metadata->next->prev = metadata->prev;
-      } else {
-        endOfFree = metadata->prev;
-      }
-    }
+  if (ptr == NULL) {
+    return;
   }
+  release(ptr);
 }
 
 /**
@@ -253,15 +1546,153 @@ void free(void *ptr) {
  */
 void *realloc(void *ptr, size_t size) {
   // implement realloc:
+  if (ptr == NULL) {
+    return allocate(size, 0);
+  }
   if (size == 0) {
+    release(ptr);
     return NULL;
   }
-  metadata_t *metadata = (metadata_t *)((char *)ptr - sizeof(metadata_t));
-  if (metadata->size >= size) {
-    return ptr;
+  metadata_t *metadata = checkedBlock(ptr);
+  if (size > MAX_REQUEST) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  size_t aligned = requestSize(size);
+  void *resized = NULL;
+  if (metadata->tag & MMAPPED) {
+    if (size >= mmapThreshold || aligned > ARENA_BLOCK_MAX) {
+      resized = mmapReallocate(metadata, aligned);
+    } else if (blockSize(metadata) >= aligned) {
+      resized = ptr;
+    }
+    if (resized != NULL) {
+      armBlock(resized, size);
+    }
+  } else {
+    arena_t *owner = &arenas[blockArena(metadata)];
+    resized = ptr;
+    pthread_mutex_lock(&owner->lock);
+    if (aligned > ARENA_BLOCK_MAX) {
+      // Too large for an arena block: it moves to a mapping of its own.
+      resized = NULL;
+    } else if (aligned > blockSize(metadata)) {
+      resized = growInPlace(owner, metadata, aligned);
+    } else if (blockSize(metadata) - aligned >= MIN_SPLIT) {
+      shrinkInPlace(owner, metadata, aligned);
+    }
+    if (resized != NULL) {
+      armBlock(resized, size);
+    }
+    pthread_mutex_unlock(&owner->lock);
   }
-  void *newPtr = malloc(size);
-  memcpy(newPtr, ptr, metadata->size);
-  free(ptr);
+  if (resized != NULL) {
+    return resized;
+  }
+
+  void *newPtr = allocate(size, 0);
+  if (newPtr == NULL) {
+    return NULL;
+  }
+  size_t used = usableSize(metadata);
+  memcpy(newPtr, ptr, (used < size) ? used : size);
+  release(ptr);
   return newPtr;
-}
\ No newline at end of file
+}
+
+/**
+ * Allocate aligned memory
+ *
+ * Allocates size bytes whose address is a multiple of alignment and stores
+ * it in *memptr.  The memory is not initialized and is released with free().
+ *
+ * @param memptr
+ *    Where to store the pointer to the allocated block.
+ * @param alignment
+ *    Alignment of the block: a power of two and a multiple of sizeof(void *).
+ * @param size
+ *    Size of the memory block, in bytes.
+ *
+ * @return
+ *    0 on success, EINVAL if alignment is not valid, or ENOMEM if the block
+ *    could not be allocated (*memptr is left unchanged on failure).
+ *
+ * @see https://man7.org/linux/man-pages/man3/posix_memalign.3.html
+ */
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+  if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  void *ptr = allocateAligned(alignment, size);
+  if (ptr == NULL) {
+    return ENOMEM;
+  }
+  *memptr = ptr;
+  return 0;
+}
+
+/**
+ * Allocate aligned memory (C11)
+ *
+ * Same as posix_memalign(), but returns the block (or NULL, with errno set)
+ * and accepts any power of two as alignment.
+ */
+void *aligned_alloc(size_t alignment, size_t size) {
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  return allocateAligned(alignment, size);
+}
+
+/**
+ * Allocate aligned memory (obsolete)
+ *
+ * Same as aligned_alloc(), except that, as with glibc, an alignment that is
+ * not a power of two is rounded up to one.
+ */
+void *memalign(size_t alignment, size_t size) {
+  if (alignment > SIZE_MAX / 2 + 1) {
+    errno = EINVAL;
+    return NULL;
+  }
+  size_t powerOfTwo = 1;
+  while (powerOfTwo < alignment) {
+    powerOfTwo <<= 1;
+  }
+  return allocateAligned(powerOfTwo, size);
+}
+
+/**
+ * Allocate page-aligned memory (obsolete)
+ *
+ * valloc() allocates size bytes at the start of a page; pvalloc() also rounds
+ * size up to a whole number of pages.
+ */
+void *valloc(size_t size) {
+  return allocateAligned(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  if (size > SIZE_MAX - page) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return allocateAligned(page, (size + page - 1) & ~(page - 1));
+}
+
+/**
+ * Usable size of a memory block
+ *
+ * Returns how many bytes of the block at ptr, previously allocated by any of
+ * the functions above, the program may use; this can be more than it asked
+ * for.  Returns 0 if ptr is NULL.
+ */
+size_t malloc_usable_size(void *ptr) {
+  if (ptr == NULL) {
+    return 0;
+  }
+  return usableSize(checkedBlock(ptr));
+}
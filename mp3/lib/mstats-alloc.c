@@ -14,12 +14,17 @@
 #include <fcntl.h>
 #include <execinfo.h>
 #include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
 
 #ifndef __APPLE__
 #include <malloc.h>
 #endif
 
 #include "mstats-alloc.h"
+#include "mstats-profile.h"
 
 void *alloc_handle = NULL;
 
@@ -27,11 +32,29 @@ void *(*alloc_calloc)(size_t nmemb, size_t size) = NULL;
 void *(*alloc_malloc)(size_t size) = NULL;
 void  (*alloc_free)(void *ptr) = NULL;
 void *(*alloc_realloc)(void *ptr, size_t size) = NULL;
+int   (*alloc_posix_memalign)(void **memptr, size_t alignment, size_t size) = NULL;
+void *(*alloc_aligned_alloc)(size_t alignment, size_t size) = NULL;
+void *(*alloc_memalign)(size_t alignment, size_t size) = NULL;
+void *(*alloc_valloc)(size_t size) = NULL;
+void *(*alloc_pvalloc)(size_t size) = NULL;
+size_t (*alloc_malloc_usable_size)(void *ptr) = NULL;
 
 void *(*libc_calloc)(size_t nmemb, size_t size) = NULL;
 void *(*libc_malloc)(size_t size) = NULL;
 void (*libc_free)(void *ptr) = NULL;
 void *(*libc_realloc)(void *ptr, size_t size) = NULL;
+int   (*libc_posix_memalign)(void **memptr, size_t alignment, size_t size) = NULL;
+void *(*libc_aligned_alloc)(size_t alignment, size_t size) = NULL;
+void *(*libc_memalign)(size_t alignment, size_t size) = NULL;
+void *(*libc_valloc)(size_t size) = NULL;
+void *(*libc_pvalloc)(size_t size) = NULL;
+size_t (*libc_malloc_usable_size)(void *ptr) = NULL;
+
+void *(*libc_mmap)(void *addr, size_t length, int prot, int flags, int fd, off_t offset) = NULL;
+int   (*libc_munmap)(void *addr, size_t length) = NULL;
+#ifndef __APPLE__
+void *(*libc_mremap)(void *old_address, size_t old_size, size_t new_size, int flags, ...) = NULL;
+#endif
 
 #ifdef __APPLE__
 void *(*mmap_sbrk)(intptr_t increment) = NULL;
@@ -42,14 +65,71 @@ void *sbrk_start = 0;
 void *sbrk_largest = 0;
 void *sbrk_init_done = 0;
 
-char _buffer[4096];
+// Bytes the allocator holds in its own mappings.  Only mmap() calls made from
+// inside the allocator count (see IN_ALLOCATOR): the program's, and mstats's,
+// are not heap.
+unsigned long long mapped_bytes = 0;
+static __thread int in_allocator __attribute__((tls_model("initial-exec")));
+
+// Runs `call` (a call into the allocator) with its mappings counted as heap:
+#define IN_ALLOCATOR(call) do { in_allocator++; call; in_allocator--; } while (0)
+
+// Serves allocations made while the alloc library is still being loaded
+// (dlopen() alone allocates several KB with glibc on x86_64).
+char _buffer[64 * 1024] __attribute__((aligned(16)));
 const void *buffer_start = (void *)_buffer;
 void *buffer = (void *)_buffer;
 
 alloc_stats_t *stats = NULL;
+alloc_proc_stats_t *proc_stats = NULL;
 
 int alloc_init_stage = 0;
 
+/*
+ * Points `proc_stats` at the slot of this process: the one it already had
+ * before an exec(), or a new one.  Only this process ever writes its `pid`,
+ * so the lookup needs no lock.
+ */
+void stats_claim_slot() {
+	int pid = getpid();
+	unsigned int count = __atomic_load_n(&stats->proc_count, __ATOMIC_ACQUIRE);
+	if (count > ALLOC_STATS_PROCS) { count = ALLOC_STATS_PROCS; }
+
+	alloc_proc_stats_t *slot = NULL;
+	for (unsigned int i = 0; i < count; i++) {
+		if (__atomic_load_n(&stats->procs[i].pid, __ATOMIC_RELAXED) == pid) {
+			slot = &stats->procs[i];
+			break;
+		}
+	}
+
+	if (!slot) {
+		unsigned int i = __atomic_fetch_add(&stats->proc_count, 1, __ATOMIC_ACQ_REL);
+		if (i >= ALLOC_STATS_PROCS) {
+			proc_stats = &stats->other_procs;
+			return;
+		}
+		slot = &stats->procs[i];
+		slot->ppid = getppid();
+		__atomic_store_n(&slot->pid, pid, __ATOMIC_RELEASE);
+	}
+
+	#ifdef __APPLE__
+	const char *command = getprogname();
+	#else
+	const char *command = program_invocation_short_name;
+	#endif
+	strncpy(slot->command, command ? command : "?", sizeof(slot->command) - 1);
+	proc_stats = slot;
+}
+
+
+// A forked child keeps the parent's heap (and `sbrk_start`) but gets its own stats:
+void stats_fork_child() {
+	stats_claim_slot();
+}
+
+
 void stats_alloc_init() {
   /*
    * Phase 1: Store references to the system's (libc) alloc library.
@@ -57,13 +137,21 @@ void stats_alloc_init() {
    */
 	alloc_init_stage = 1;
 
+	// Before anything else here can mmap():
+	libc_mmap   = dlsym(RTLD_NEXT, "mmap");
+	libc_munmap = dlsym(RTLD_NEXT, "munmap");
+	#ifndef __APPLE__
+	libc_mremap = dlsym(RTLD_NEXT, "mremap");
+	#endif
+
 	#ifdef USE_LIBC_ALLOC
   printf("[mstats-alloc]: Injecting stat tracking into libc's malloc.\n");	
 	#else
   printf("[mstats-alloc]: Injecting your alloc library into the running process.\n");
 	#endif
 	
-	// Tell malloc() not to use mmap() (for contact tracing):
+	// Tell malloc() not to use mmap(): libc maps its blocks with internal calls
+	// that the mmap() wrapper below never sees, so they would not be counted.
 	#ifndef __APPLE__
 	mallopt(M_MMAP_MAX, 0);	
 	#endif
@@ -71,6 +159,12 @@ void stats_alloc_init() {
 	libc_malloc  = dlsym(RTLD_NEXT, "malloc");
 	libc_free    = dlsym(RTLD_NEXT, "free");
 	libc_realloc = dlsym(RTLD_NEXT, "realloc");
+	libc_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+	libc_aligned_alloc  = dlsym(RTLD_NEXT, "aligned_alloc");
+	libc_memalign       = dlsym(RTLD_NEXT, "memalign");
+	libc_valloc         = dlsym(RTLD_NEXT, "valloc");
+	libc_pvalloc        = dlsym(RTLD_NEXT, "pvalloc");
+	libc_malloc_usable_size = dlsym(RTLD_NEXT, "malloc_usable_size");
 
   #ifdef __APPLE__
   libc_sbrk    = dlsym(RTLD_NEXT, "sbrk");
@@ -104,8 +198,17 @@ void stats_alloc_init() {
 	alloc_malloc  = libc_malloc;
 	alloc_free    = libc_free;
 	alloc_realloc = libc_realloc;	
+	alloc_posix_memalign = libc_posix_memalign;
+	alloc_aligned_alloc  = libc_aligned_alloc;
+	alloc_memalign       = libc_memalign;
+	alloc_valloc         = libc_valloc;
+	alloc_pvalloc        = libc_pvalloc;
+	alloc_malloc_usable_size = libc_malloc_usable_size;
 	#else		
-	alloc_handle = dlopen("./alloc.so", RTLD_NOW | RTLD_GLOBAL);
+	// ALLOC_LIBRARY picks another build of the allocator (e.g. ./alloc-debug.so):
+	const char *alloc_library = getenv("ALLOC_LIBRARY");
+	if (!alloc_library || !*alloc_library) { alloc_library = "./alloc.so"; }
+	alloc_handle = dlopen(alloc_library, RTLD_NOW | RTLD_GLOBAL);
 	if (!alloc_handle) {
 		char *err =  dlerror();
 
@@ -118,8 +221,16 @@ void stats_alloc_init() {
 	alloc_malloc  = dlsym(alloc_handle, "malloc");
 	alloc_free    = dlsym(alloc_handle, "free");
 	alloc_realloc = dlsym(alloc_handle, "realloc");
-
-	if (!alloc_calloc || !alloc_malloc || !alloc_free || !alloc_realloc) {
+	alloc_posix_memalign = dlsym(alloc_handle, "posix_memalign");
+	alloc_aligned_alloc  = dlsym(alloc_handle, "aligned_alloc");
+	alloc_memalign       = dlsym(alloc_handle, "memalign");
+	alloc_valloc         = dlsym(alloc_handle, "valloc");
+	alloc_pvalloc        = dlsym(alloc_handle, "pvalloc");
+	alloc_malloc_usable_size = dlsym(alloc_handle, "malloc_usable_size");
+
+	if (!alloc_calloc || !alloc_malloc || !alloc_free || !alloc_realloc ||
+	    !alloc_posix_memalign || !alloc_aligned_alloc || !alloc_memalign ||
+	    !alloc_valloc || !alloc_pvalloc || !alloc_malloc_usable_size) {
 		fprintf(stderr, "Unable to dynamicly load a required memory allocation call.\n");
 		exit(66);
 	}
@@ -128,30 +239,80 @@ void stats_alloc_init() {
 	
 	char *file_name = getenv("ALLOC_STATS_MMAP");
 	int fd = open(file_name, O_RDWR);
-	stats = mmap(NULL, sizeof(alloc_stats_t), PROT_WRITE, MAP_SHARED, fd, 0);
+
+	// The file is larger than alloc_stats_t when mstats reserved a trace ring:
+	struct stat st;
+	size_t stats_size = sizeof(alloc_stats_t);
+	if (fd > 0 && fstat(fd, &st) == 0 && (size_t)st.st_size > stats_size) {
+		stats_size = st.st_size;
+	}
+	stats = mmap(NULL, stats_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 
 	if (fd <= 0 || stats == (void *)-1) {
 		fprintf(stderr, "fd/mmap");
 		exit(67);
 	}
+	close(fd);
+
+	if (ALLOC_STATS_SIZE(stats->trace_capacity) > stats_size) {
+		stats->trace_capacity = 0;
+	}
 	
-	stats->max_heap_used = 0;
-	stats->memory_heap_sum = 0;
-	stats->memory_uses = 0;
+	stats_claim_slot();
 	
 	sbrk_init_done = sbrk(0);
 	sbrk_start = sbrk_largest = sbrk(0);
 	alloc_init_stage = 3;
+
+	pthread_atfork(NULL, NULL, stats_fork_child);
+
+	profile_init();
 }
 
 
+void *buffer_alloc(size_t size) {
+	void *addr = buffer;
+	buffer += (size + 15) & ~(size_t)15;
+	if (buffer > buffer_start + sizeof(_buffer)) {
+		fprintf(stderr, "[mstats-alloc]: Bootstrap buffer exhausted.\n");
+		exit(69);
+	}
+	return addr;
+}
+
+
+void *buffer_alloc_aligned(size_t alignment, size_t size) {
+	if (alignment > 16) {
+		buffer = (void *)(((unsigned long)buffer + alignment - 1) & ~(unsigned long)(alignment - 1));
+	}
+	return buffer_alloc(size);
+}
+
+
+/*
+ * Returns the heap in use: how far the program break has moved, plus the
+ * allocator's own mappings.
+ */
+unsigned long long heap_used() {
+	return ((unsigned long long)sbrk(0) - (unsigned long long)sbrk_start) +
+	       __atomic_load_n(&mapped_bytes, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Updates this process's stats.  Threads of the process share the slot, so
+ * every update is atomic.
+ */
 void stats_tracking() {
 	void *sbrk_current = sbrk(0);
-	unsigned long current_mem_usage = ((long)sbrk_current - (long)sbrk_start);
+	unsigned long current_mem_usage = heap_used();
 	
-	if (stats->max_heap_used < current_mem_usage) {
+	unsigned long long max_heap_used = __atomic_load_n(&proc_stats->max_heap_used, __ATOMIC_RELAXED);
+	if (max_heap_used < current_mem_usage) {
+		while (max_heap_used < current_mem_usage &&
+		       !__atomic_compare_exchange_n(&proc_stats->max_heap_used, &max_heap_used, current_mem_usage,
+		                                    1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { }
 		sbrk_largest = sbrk_current;
-		stats->max_heap_used = current_mem_usage;
 
 		if (current_mem_usage > ((double)1024) * ((double)1024) * ((double)1024) * 2)
 		{
@@ -160,8 +321,47 @@ void stats_tracking() {
 		}
 	}
 	
-	stats->memory_heap_sum += current_mem_usage;
-	stats->memory_uses++;
+	__atomic_fetch_add(&proc_stats->memory_heap_sum, current_mem_usage, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&proc_stats->memory_uses, 1, __ATOMIC_RELAXED);
+}
+
+
+unsigned long long trace_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+// Returns the time a traced call started, or 0 when tracing is off.
+unsigned long long trace_start() {
+	return stats->trace_capacity ? trace_now() : 0;
+}
+
+
+/*
+ * Updates the heap stats after a call into the allocator and, when tracing,
+ * appends the call to the trace ring.  Slots are claimed with an atomic
+ * increment so threads (and forked children sharing the file) never write the
+ * same slot at once; `seq` is stored last so the reader can skip slots that
+ * were claimed but never completed.
+ */
+void stats_record(unsigned int type, void *addr, void *ptr, size_t size, unsigned long long start) {
+	unsigned long long end = start ? trace_now() : 0;
+	stats_tracking();
+	if (!start) { return; }
+
+	unsigned long long idx = __atomic_fetch_add(&stats->trace_head, 1, __ATOMIC_RELAXED);
+	alloc_event_t *event = &stats->trace[idx % stats->trace_capacity];
+
+	event->timestamp = end - stats->trace_epoch;
+	event->addr = (unsigned long long)addr;
+	event->ptr = (unsigned long long)ptr;
+	event->size = size;
+	event->heap_used = heap_used();
+	event->latency = (unsigned int)(end - start);
+	event->type = type;
+	__atomic_store_n(&event->seq, idx + 1, __ATOMIC_RELEASE);
 }
 
 
@@ -169,28 +369,84 @@ void stats_tracking() {
 void *sbrk(int increment) {
 	if (alloc_init_stage == 0) { stats_alloc_init(); }
 
+  // The wrapper's own mapping is the heap, which is already counted:
+  int saved_in_allocator = in_allocator;
+  in_allocator = 0;
+  void *result = NULL;
   if (mmap_sbrk) {
-    return mmap_sbrk(increment);
+    result = mmap_sbrk(increment);
   } else if (libc_sbrk) {
-    return libc_sbrk(increment);
-  } else {
-    return NULL;
+    result = libc_sbrk(increment);
   }
+  in_allocator = saved_in_allocator;
+  return result;
 };
 #endif
 
 
+size_t page_round(size_t length) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	return (length + page - 1) & ~(page - 1);
+}
+
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+	if (alloc_init_stage == 0) { stats_alloc_init(); }
+
+	void *mapping = libc_mmap(addr, length, prot, flags, fd, offset);
+	if (in_allocator && mapping != MAP_FAILED) {
+		__atomic_fetch_add(&mapped_bytes, page_round(length), __ATOMIC_RELAXED);
+	}
+	return mapping;
+}
+
+
+int munmap(void *addr, size_t length) {
+	if (alloc_init_stage == 0) { stats_alloc_init(); }
+
+	int result = libc_munmap(addr, length);
+	if (in_allocator && result == 0) {
+		__atomic_fetch_sub(&mapped_bytes, page_round(length), __ATOMIC_RELAXED);
+	}
+	return result;
+}
+
+
+#ifndef __APPLE__
+void *mremap(void *old_address, size_t old_size, size_t new_size, int flags, ...) {
+	if (alloc_init_stage == 0) { stats_alloc_init(); }
+
+	void *new_address = NULL;
+	if (flags & MREMAP_FIXED) {
+		va_list args;
+		va_start(args, flags);
+		new_address = va_arg(args, void *);
+		va_end(args);
+	}
+
+	void *mapping = libc_mremap(old_address, old_size, new_size, flags, new_address);
+	if (in_allocator && mapping != MAP_FAILED) {
+		__atomic_fetch_add(&mapped_bytes, page_round(new_size) - page_round(old_size), __ATOMIC_RELAXED);
+	}
+	return mapping;
+}
+#endif
+
+
 void *calloc(size_t nmemb, size_t size) {
 	if (alloc_init_stage == 0) {
 		stats_alloc_init();
 	} else if (alloc_init_stage == 1 || alloc_init_stage == 2) {
-		memset(buffer, 0x00, nmemb * size);
-		buffer += nmemb * size;
-		return buffer - (nmemb * size);
+		void *addr = buffer_alloc(nmemb * size);
+		memset(addr, 0x00, nmemb * size);
+		return addr;
 	}
 
-	void *addr = alloc_calloc(nmemb, size);
-	stats_tracking();
+	unsigned long long start = trace_start();
+	void *addr;
+	IN_ALLOCATOR(addr = alloc_calloc(nmemb, size));
+	stats_record(ALLOC_EVENT_CALLOC, addr, NULL, nmemb * size, start);
+	profile_alloc(addr, nmemb * size);
 
 	return addr;
 }
@@ -200,12 +456,14 @@ void *malloc(size_t size) {
 	if (alloc_init_stage == 0) {
 		stats_alloc_init();
 	} else if (alloc_init_stage < 3) {
-		buffer += size;
-		return buffer - size;
+		return buffer_alloc(size);
   }
 
-	void *addr = alloc_malloc(size);
-	stats_tracking();
+	unsigned long long start = trace_start();
+	void *addr;
+	IN_ALLOCATOR(addr = alloc_malloc(size));
+	stats_record(ALLOC_EVENT_MALLOC, addr, NULL, size, start);
+	profile_alloc(addr, size);
 
 	return addr;
 }
@@ -219,8 +477,10 @@ void free(void *ptr) {
 	}
 	
 	if (ptr) {
-		alloc_free(ptr);
-		stats_tracking();
+		unsigned long long start = trace_start();
+		profile_free(ptr);
+		IN_ALLOCATOR(alloc_free(ptr));
+		stats_record(ALLOC_EVENT_FREE, ptr, NULL, 0, start);
 	}
 }
 
@@ -228,14 +488,122 @@ void *realloc(void *ptr, size_t size) {
 	if (alloc_init_stage == 0) {
 		stats_alloc_init();
 	} else if (alloc_init_stage < 3) {
-		void *newPtr = buffer;
-		buffer += size;
+		void *newPtr = buffer_alloc(size);
 		if (ptr && size) { memcpy(newPtr, ptr, size); }
 		return newPtr;
   }
 
-	void *addr = alloc_realloc(ptr, size);
-	stats_tracking();
+	unsigned long long start = trace_start();
+	void *addr;
+	IN_ALLOCATOR(addr = alloc_realloc(ptr, size));
+	stats_record(ALLOC_EVENT_REALLOC, addr, ptr, size, start);
+	if (addr || size == 0) {
+		profile_free(ptr);
+		profile_alloc(addr, size);
+	}
+
+	return addr;
+}
+
+
+/*
+ * The aligned allocation calls are traced as ALLOC_EVENT_MALLOC: the trace
+ * records what was allocated, not the alignment it was asked for.
+ */
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+	if (alloc_init_stage == 0) {
+		stats_alloc_init();
+	} else if (alloc_init_stage < 3) {
+		*memptr = buffer_alloc_aligned(alignment, size);
+		return 0;
+	}
+
+	unsigned long long start = trace_start();
+	int result;
+	IN_ALLOCATOR(result = alloc_posix_memalign(memptr, alignment, size));
+	void *addr = result ? NULL : *memptr;
+	stats_record(ALLOC_EVENT_MALLOC, addr, NULL, size, start);
+	profile_alloc(addr, size);
+
+	return result;
+}
+
+
+void *aligned_alloc(size_t alignment, size_t size) {
+	if (alloc_init_stage == 0) {
+		stats_alloc_init();
+	} else if (alloc_init_stage < 3) {
+		return buffer_alloc_aligned(alignment, size);
+	}
+
+	unsigned long long start = trace_start();
+	void *addr;
+	IN_ALLOCATOR(addr = alloc_aligned_alloc(alignment, size));
+	stats_record(ALLOC_EVENT_MALLOC, addr, NULL, size, start);
+	profile_alloc(addr, size);
+
+	return addr;
+}
+
+
+void *memalign(size_t alignment, size_t size) {
+	if (alloc_init_stage == 0) {
+		stats_alloc_init();
+	} else if (alloc_init_stage < 3) {
+		return buffer_alloc_aligned(alignment, size);
+	}
+
+	unsigned long long start = trace_start();
+	void *addr;
+	IN_ALLOCATOR(addr = alloc_memalign(alignment, size));
+	stats_record(ALLOC_EVENT_MALLOC, addr, NULL, size, start);
+	profile_alloc(addr, size);
+
+	return addr;
+}
+
+
+void *valloc(size_t size) {
+	if (alloc_init_stage == 0) {
+		stats_alloc_init();
+	} else if (alloc_init_stage < 3) {
+		return buffer_alloc_aligned(sysconf(_SC_PAGESIZE), size);
+	}
+
+	unsigned long long start = trace_start();
+	void *addr;
+	IN_ALLOCATOR(addr = alloc_valloc(size));
+	stats_record(ALLOC_EVENT_MALLOC, addr, NULL, size, start);
+	profile_alloc(addr, size);
+
+	return addr;
+}
+
+
+void *pvalloc(size_t size) {
+	if (alloc_init_stage == 0) {
+		stats_alloc_init();
+	} else if (alloc_init_stage < 3) {
+		return buffer_alloc_aligned(sysconf(_SC_PAGESIZE), size);
+	}
+
+	unsigned long long start = trace_start();
+	void *addr;
+	IN_ALLOCATOR(addr = alloc_pvalloc(size));
+	stats_record(ALLOC_EVENT_MALLOC, addr, NULL, size, start);
+	profile_alloc(addr, size);
 
 	return addr;
 }
+
+
+size_t malloc_usable_size(void *ptr) {
+	if (alloc_init_stage == 0) {
+		stats_alloc_init();
+	}
+	// The size of a bootstrap buffer block is not kept:
+	if (alloc_init_stage < 3 || (ptr >= buffer_start && ptr < buffer)) {
+		return 0;
+	}
+	return alloc_malloc_usable_size(ptr);
+}
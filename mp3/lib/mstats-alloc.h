@@ -1,7 +1,51 @@
 #pragma once
 
-typedef struct _alloc_stats_t {
+// Kinds of alloc_event_t:
+#define ALLOC_EVENT_MALLOC  1
+#define ALLOC_EVENT_CALLOC  2
+#define ALLOC_EVENT_REALLOC 3
+#define ALLOC_EVENT_FREE    4
+
+// One traced call into the allocator.
+typedef struct _alloc_event_t {
+    unsigned long long seq;        // Index of the event + 1; written last.
+    unsigned long long timestamp;  // ns since `trace_epoch`.
+    unsigned long long addr;       // Address returned (or freed).
+    unsigned long long ptr;        // realloc: the block passed in.
+    unsigned long long size;       // Bytes requested (nmemb * size for calloc).
+    unsigned long long heap_used;  // Heap in use right after the call.
+    unsigned int latency;          // ns spent inside the allocator.
+    unsigned int type;             // ALLOC_EVENT_*
+} alloc_event_t;
+
+// Processes that can have their own stats; any more share `other_procs`.
+#define ALLOC_STATS_PROCS 64
+
+// Heap stats of one process running under mstats.
+typedef struct _alloc_proc_stats_t {
+    int pid;                           // 0 while the slot is unused.
+    int ppid;
     unsigned long long max_heap_used;
     unsigned long memory_uses;
     unsigned long long memory_heap_sum;
+    char command[16];                  // Name of the last program the process ran.
+} alloc_proc_stats_t;
+
+typedef struct _alloc_stats_t {
+    // Every process that loads mstats-alloc (the program, its forked children,
+    // and anything they exec) claims a slot by atomically incrementing
+    // `proc_count`, and then updates only that slot, with atomic operations.
+    unsigned int proc_count;
+    alloc_proc_stats_t procs[ALLOC_STATS_PROCS];
+    alloc_proc_stats_t other_procs;
+
+    // Optional event trace (MSTATS_TRACE): a ring of `trace_capacity` events
+    // stored right after this struct in the shared file.  Writers claim a
+    // slot by atomically incrementing `trace_head`.
+    unsigned long long trace_capacity;
+    unsigned long long trace_head;
+    unsigned long long trace_epoch;
+    alloc_event_t trace[];
 } alloc_stats_t;
+
+#define ALLOC_STATS_SIZE(capacity) (sizeof(alloc_stats_t) + (capacity) * sizeof(alloc_event_t))
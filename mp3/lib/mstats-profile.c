@@ -0,0 +1,277 @@
+/*
+ * Sampling heap profiler for mstats-alloc.
+ *
+ * Everything here runs inside malloc()/free(), so none of it may allocate:
+ * the tables are mmap()'d up front and the reports are written with write().
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <signal.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <sys/mman.h>
+
+#include "mstats-profile.h"
+
+#define PROFILE_MAX_DEPTH 32
+#define PROFILE_STACKS (1 << 14)   // Distinct call stacks (power of two).
+#define PROFILE_BLOCKS (1 << 20)   // Sampled blocks live at once (power of two).
+#define PROFILE_LINE 8192
+
+// One distinct call stack and the sampled bytes allocated from it:
+typedef struct {
+	unsigned long long hash;
+	unsigned long long live_bytes;
+	unsigned long long alloc_bytes;
+	unsigned int depth;
+	void *frames[PROFILE_MAX_DEPTH];
+} profile_stack_t;
+
+// A sampled block that has not been freed yet:
+typedef struct {
+	void *addr;
+	size_t size;
+	unsigned int stack;
+} profile_block_t;
+
+static unsigned long rate = 0;
+static unsigned long calls = 0;
+static char file_prefix[256] = "mstats-profile";
+
+static profile_stack_t *stacks = NULL;
+static unsigned int stack_count = 0;
+static profile_block_t *blocks = NULL;
+static unsigned int block_count = 0;
+
+static char lock = 0;
+
+// Set while the profiler itself is running (backtrace() and dladdr() may call malloc()).
+static __thread int in_profiler __attribute__((tls_model("initial-exec")));
+
+
+static void profile_lock()   { while (__atomic_test_and_set(&lock, __ATOMIC_ACQUIRE)) { } }
+static void profile_unlock() { __atomic_clear(&lock, __ATOMIC_RELEASE); }
+
+
+static unsigned long long hash_frames(void **frames, int depth) {
+	unsigned long long hash = 14695981039346656037ULL;
+	for (int i = 0; i < depth; i++) {
+		hash = (hash ^ (unsigned long long)frames[i]) * 1099511628211ULL;
+	}
+	return hash | 1;  // 0 marks an empty slot.
+}
+
+// Returns the index of the stack `frames`, adding it if it is new (or -1 if full).
+static int find_stack(void **frames, int depth) {
+	unsigned long long hash = hash_frames(frames, depth);
+	unsigned int i = hash & (PROFILE_STACKS - 1);
+	while (stacks[i].hash) {
+		if (stacks[i].hash == hash && stacks[i].depth == (unsigned int)depth &&
+		    memcmp(stacks[i].frames, frames, depth * sizeof(void *)) == 0) {
+			return i;
+		}
+		i = (i + 1) & (PROFILE_STACKS - 1);
+	}
+
+	if (stack_count >= PROFILE_STACKS * 3 / 4) { return -1; }
+	stack_count++;
+	stacks[i].hash = hash;
+	stacks[i].depth = depth;
+	memcpy(stacks[i].frames, frames, depth * sizeof(void *));
+	return i;
+}
+
+static unsigned int block_hash(void *addr) {
+	return (unsigned int)(((unsigned long long)addr >> 4) * 0x9E3779B97F4A7C15ULL >> 40) & (PROFILE_BLOCKS - 1);
+}
+
+
+/*
+ * Writes one folded-stack file: "root;...;leaf bytes" per line, with the
+ * sampled bytes scaled up by the sampling rate.
+ */
+static void write_report(const char *suffix, int live) {
+	char path[512];
+	snprintf(path, sizeof(path), "%s.%d%s", file_prefix, (int)getpid(), suffix);
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) { return; }
+
+	for (unsigned int s = 0; s < PROFILE_STACKS; s++) {
+		unsigned long long bytes = live ? stacks[s].live_bytes : stacks[s].alloc_bytes;
+		if (!stacks[s].hash || !bytes) { continue; }
+
+		char line[PROFILE_LINE];
+		size_t len = 0;
+		for (int f = stacks[s].depth - 1; f >= 0 && len < sizeof(line) - 64; f--) {
+			Dl_info info;
+			void *frame = stacks[s].frames[f];
+			int found = dladdr(frame, &info);
+			int n;
+			if (found && info.dli_sname) {
+				n = snprintf(line + len, sizeof(line) - len, "%s;", info.dli_sname);
+			} else if (found && info.dli_fname) {
+				const char *module = strrchr(info.dli_fname, '/');
+				n = snprintf(line + len, sizeof(line) - len, "%s+0x%lx;", module ? module + 1 : info.dli_fname,
+				             (unsigned long)((char *)frame - (char *)info.dli_fbase));
+			} else {
+				n = snprintf(line + len, sizeof(line) - len, "%p;", frame);
+			}
+			if (n > 0) { len += n; }
+		}
+		if (len >= sizeof(line) - 64) { len = sizeof(line) - 64; }
+		if (len > 0) { len--; }  // Drop the trailing ';'.
+		len += snprintf(line + len, sizeof(line) - len, " %llu\n", bytes * rate);
+		write(fd, line, len);
+	}
+
+	close(fd);
+}
+
+static void dump() {
+	in_profiler = 1;
+	profile_lock();
+	write_report(".folded", 1);
+	write_report(".alloc.folded", 0);
+	profile_unlock();
+	in_profiler = 0;
+}
+
+
+/*
+ * Writes the profile each time PROFILE_DUMP_SIGNAL arrives.  Every other
+ * thread blocks the signal, so it is delivered here even while the program
+ * sits in accept() or poll() and never calls malloc().
+ */
+static void *dump_thread(void *arg) {
+	(void)arg;
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, PROFILE_DUMP_SIGNAL);
+
+	int signum;
+	while (sigwait(&set, &signum) == 0) { dump(); }
+	return NULL;
+}
+
+static void start_dump_thread() {
+	pthread_attr_t attr;
+	pthread_t thread;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, dump_thread, NULL) != 0) {
+		fprintf(stderr, "[mstats-alloc]: Unable to start the heap profiler's dump thread.\n");
+	}
+	pthread_attr_destroy(&attr);
+}
+
+static void fork_prepare() { profile_lock(); }
+static void fork_release() { profile_unlock(); }
+
+// Only the forking thread lives on in the child, so it needs a dump thread of its own:
+static void fork_child() {
+	profile_unlock();
+	start_dump_thread();
+}
+
+__attribute__((destructor))
+static void profile_exit() {
+	if (rate) { dump(); }
+}
+
+
+void profile_init() {
+	char *env = getenv("MSTATS_PROFILE");
+	if (!env || atol(env) <= 0) { return; }
+
+	char *prefix = getenv("MSTATS_PROFILE_FILE");
+	if (prefix && *prefix) { snprintf(file_prefix, sizeof(file_prefix), "%s", prefix); }
+
+	stacks = mmap(NULL, PROFILE_STACKS * sizeof(profile_stack_t), PROT_READ | PROT_WRITE,
+	              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	blocks = mmap(NULL, PROFILE_BLOCKS * sizeof(profile_block_t), PROT_READ | PROT_WRITE,
+	              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (stacks == MAP_FAILED || blocks == MAP_FAILED) {
+		fprintf(stderr, "[mstats-alloc]: Unable to set up the heap profiler.\n");
+		return;
+	}
+
+	// The first backtrace() loads libgcc, which allocates; get that out of the way:
+	void *frames[1];
+	in_profiler = 1;
+	backtrace(frames, 1);
+	in_profiler = 0;
+
+	// Threads the program starts later inherit this mask from the main thread:
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, PROFILE_DUMP_SIGNAL);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	pthread_atfork(fork_prepare, fork_release, fork_child);
+
+	rate = atol(env);
+	start_dump_thread();
+}
+
+
+void profile_alloc(void *addr, size_t size) {
+	if (!rate || !addr || in_profiler) { return; }
+	if (__atomic_add_fetch(&calls, 1, __ATOMIC_RELAXED) % rate != 0) { return; }
+
+	in_profiler = 1;
+	void *frames[PROFILE_MAX_DEPTH + 2];
+	int depth = backtrace(frames, PROFILE_MAX_DEPTH + 2);
+
+	// Skip the frames inside mstats-alloc itself (this function and the wrapper):
+	Dl_info self, info;
+	int skip = 0;
+	if (dladdr((void *)profile_alloc, &self)) {
+		while (skip < depth && dladdr(frames[skip], &info) && info.dli_fbase == self.dli_fbase) { skip++; }
+	}
+	if (depth - skip > PROFILE_MAX_DEPTH) { depth = skip + PROFILE_MAX_DEPTH; }
+
+	profile_lock();
+	int stack = find_stack(frames + skip, depth - skip);
+	if (stack >= 0 && block_count < PROFILE_BLOCKS * 3 / 4) {
+		unsigned int i = block_hash(addr);
+		while (blocks[i].addr && blocks[i].addr != addr) { i = (i + 1) & (PROFILE_BLOCKS - 1); }
+		if (!blocks[i].addr) { block_count++; }
+		else                 { stacks[blocks[i].stack].live_bytes -= blocks[i].size; }
+		blocks[i].addr = addr;
+		blocks[i].size = size;
+		blocks[i].stack = stack;
+		stacks[stack].live_bytes += size;
+		stacks[stack].alloc_bytes += size;
+	}
+	profile_unlock();
+	in_profiler = 0;
+}
+
+
+void profile_free(void *addr) {
+	if (!rate || !addr || in_profiler) { return; }
+
+	profile_lock();
+	unsigned int i = block_hash(addr);
+	while (blocks[i].addr && blocks[i].addr != addr) { i = (i + 1) & (PROFILE_BLOCKS - 1); }
+	if (blocks[i].addr) {
+		stacks[blocks[i].stack].live_bytes -= blocks[i].size;
+		blocks[i].addr = NULL;
+		block_count--;
+
+		// Shift back later entries of the probe run so lookups still find them:
+		unsigned int hole = i;
+		for (i = (i + 1) & (PROFILE_BLOCKS - 1); blocks[i].addr; i = (i + 1) & (PROFILE_BLOCKS - 1)) {
+			unsigned int home = block_hash(blocks[i].addr);
+			if (((i - home) & (PROFILE_BLOCKS - 1)) >= ((i - hole) & (PROFILE_BLOCKS - 1))) {
+				blocks[hole] = blocks[i];
+				blocks[i].addr = NULL;
+				hole = i;
+			}
+		}
+	}
+	profile_unlock();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <signal.h>
+
+// Signal that asks a profiled process to write its profile without exiting:
+#define PROFILE_DUMP_SIGNAL SIGUSR2
+
+/**
+ * Starts the heap profiler if MSTATS_PROFILE is set to N > 0, in which case
+ * the call stack of every Nth allocation is captured.  At exit (and after
+ * PROFILE_DUMP_SIGNAL), two flamegraph-compatible folded-stack files are
+ * written, named from MSTATS_PROFILE_FILE (default "mstats-profile"):
+ * - <name>.<pid>.folded:       estimated live bytes per call stack, and
+ * - <name>.<pid>.alloc.folded: estimated bytes ever allocated per call stack.
+ * The signal is blocked in the program's threads and taken by a thread of the
+ * profiler's own, so even a process idle in a system call writes its profile.
+ *
+ * Must be called once the real allocator can serve requests.
+ */
+void profile_init();
+
+/**
+ * Records that `size` bytes were allocated at `addr`, or that `addr` was
+ * freed.  Both are no-ops unless the profiler is running.
+ */
+void profile_alloc(void *addr, size_t size);
+void profile_free(void *addr);
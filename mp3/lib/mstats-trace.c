@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mstats-trace.h"
+
+#define SIZE_BUCKETS 64
+#define FRAG_SAMPLES 20
+#define BAR_WIDTH 40
+
+static const char *event_names[] = { "", "malloc", "calloc", "realloc", "free" };
+
+
+/*
+ * Live blocks (address -> size), kept in an open-addressing table with linear
+ * probing so that fragmentation can be reconstructed from the trace.
+ */
+typedef struct {
+	unsigned long long addr;
+	unsigned long long size;
+} live_slot_t;
+
+typedef struct {
+	live_slot_t *slots;
+	size_t mask;
+	unsigned long long bytes;
+} live_table_t;
+
+static size_t live_hash(const live_table_t *table, unsigned long long addr) {
+	return (size_t)((addr >> 4) * 0x9E3779B97F4A7C15ULL) & table->mask;
+}
+
+static void live_insert(live_table_t *table, unsigned long long addr, unsigned long long size) {
+	size_t i = live_hash(table, addr);
+	while (table->slots[i].addr && table->slots[i].addr != addr) {
+		i = (i + 1) & table->mask;
+	}
+	if (table->slots[i].addr) { table->bytes -= table->slots[i].size; }
+	table->slots[i].addr = addr;
+	table->slots[i].size = size;
+	table->bytes += size;
+}
+
+static void live_remove(live_table_t *table, unsigned long long addr) {
+	size_t i = live_hash(table, addr);
+	while (table->slots[i].addr != addr) {
+		if (!table->slots[i].addr) { return; }  // Allocated before the trace started.
+		i = (i + 1) & table->mask;
+	}
+	table->bytes -= table->slots[i].size;
+	table->slots[i].addr = 0;
+
+	// Shift back any later entry of the probe run that now sits past its home:
+	size_t hole = i;
+	for (i = (i + 1) & table->mask; table->slots[i].addr; i = (i + 1) & table->mask) {
+		size_t home = live_hash(table, table->slots[i].addr);
+		if (((i - home) & table->mask) >= ((i - hole) & table->mask)) {
+			table->slots[hole] = table->slots[i];
+			table->slots[i].addr = 0;
+			hole = i;
+		}
+	}
+}
+
+
+static int compare_latency(const void *a, const void *b) {
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+	return (x > y) - (x < y);
+}
+
+static int size_bucket(unsigned long long size) {
+	return size ? 63 - __builtin_clzll(size) : 0;
+}
+
+
+/*
+ * Returns (in a malloc'd array) the completed events still in the ring, oldest
+ * first, and stores how many there are in `n`.
+ */
+static const alloc_event_t **trace_collect(const alloc_stats_t *stats, size_t *n) {
+	unsigned long long capacity = stats->trace_capacity;
+	unsigned long long head = stats->trace_head;
+	unsigned long long first = (head > capacity) ? head - capacity : 0;
+
+	const alloc_event_t **events = malloc((head - first + 1) * sizeof(alloc_event_t *));
+	*n = 0;
+	for (unsigned long long idx = first; idx < head; idx++) {
+		const alloc_event_t *event = &stats->trace[idx % capacity];
+		if (event->seq == idx + 1 && event->type >= ALLOC_EVENT_MALLOC && event->type <= ALLOC_EVENT_FREE) {
+			events[(*n)++] = event;
+		}
+	}
+	return events;
+}
+
+
+long trace_save(const alloc_stats_t *stats, const char *path) {
+	if (stats->trace_capacity == 0) { return -1; }
+
+	FILE *file = fopen(path, "w");
+	if (!file) { return -1; }
+
+	size_t n;
+	const alloc_event_t **events = trace_collect(stats, &n);
+
+	trace_file_header_t header;
+	memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+	header.count = n;
+	int ok = (fwrite(&header, sizeof(header), 1, file) == 1);
+	for (size_t i = 0; ok && i < n; i++) {
+		ok = (fwrite(events[i], sizeof(alloc_event_t), 1, file) == 1);
+	}
+
+	free(events);
+	if (fclose(file) != 0 || !ok) { return -1; }
+	return (long)n;
+}
+
+
+void trace_report(const alloc_stats_t *stats) {
+	unsigned long long capacity = stats->trace_capacity;
+	unsigned long long head = stats->trace_head;
+	if (capacity == 0) { return; }
+
+	unsigned long long first = (head > capacity) ? head - capacity : 0;
+
+	printf("[mstats]: TRACE: %llu events", head);
+	if (first) { printf(" (first %llu dropped, ring holds %llu)", first, capacity); }
+	printf("\n");
+
+	size_t n;
+	const alloc_event_t **events = trace_collect(stats, &n);
+	if (n == 0) {
+		free(events);
+		return;
+	}
+
+
+	/*
+	 * Size histogram, bucketed by powers of two.
+	 */
+	unsigned long sizes[SIZE_BUCKETS] = { 0 };
+	unsigned long largest = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (events[i]->type == ALLOC_EVENT_FREE || events[i]->size == 0) { continue; }
+		int b = size_bucket(events[i]->size);
+		if (++sizes[b] > largest) { largest = sizes[b]; }
+	}
+
+	printf("[mstats]: Request sizes:\n");
+	for (int b = 0; b < SIZE_BUCKETS; b++) {
+		if (!sizes[b]) { continue; }
+		int bar = (int)((sizes[b] * BAR_WIDTH + largest - 1) / largest);
+		printf("  [%10llu, %10llu) %10lu  %.*s\n", 1ULL << b, 2ULL << b, sizes[b], bar,
+		       "########################################");
+	}
+
+
+	/*
+	 * Latency percentiles for each kind of call.
+	 */
+	unsigned int *latencies = malloc(n * sizeof(unsigned int));
+	printf("[mstats]: Latency (ns):      calls        p50        p99        max\n");
+	for (unsigned int type = ALLOC_EVENT_MALLOC; type <= ALLOC_EVENT_FREE; type++) {
+		size_t calls = 0;
+		for (size_t i = 0; i < n; i++) {
+			if (events[i]->type == type) { latencies[calls++] = events[i]->latency; }
+		}
+		if (!calls) { continue; }
+
+		qsort(latencies, calls, sizeof(unsigned int), compare_latency);
+		printf("  %-10s %15zu %10u %10u %10u\n", event_names[type], calls,
+		       latencies[(calls - 1) / 2], latencies[(calls - 1) * 99 / 100], latencies[calls - 1]);
+	}
+	free(latencies);
+
+
+	/*
+	 * Fragmentation over time: heap used (sbrk and mappings) vs. bytes the program holds.
+	 */
+	live_table_t live;
+	live.mask = 1;
+	while (live.mask < 2 * n) { live.mask <<= 1; }
+	live.slots = calloc(live.mask, sizeof(live_slot_t));
+	live.mask--;
+	live.bytes = 0;
+
+	printf("[mstats]: Fragmentation:%s\n", first ? " (live bytes exclude blocks allocated before the ring)" : "");
+	printf("  %12s %12s %12s %8s\n", "time (ms)", "heap", "live", "frag");
+	size_t step = (n + FRAG_SAMPLES - 1) / FRAG_SAMPLES;
+	for (size_t i = 0; i < n; i++) {
+		const alloc_event_t *event = events[i];
+		switch (event->type) {
+			case ALLOC_EVENT_MALLOC:
+			case ALLOC_EVENT_CALLOC:
+				if (event->addr) { live_insert(&live, event->addr, event->size); }
+				break;
+			case ALLOC_EVENT_REALLOC:
+				// A failed realloc leaves the original block in place:
+				if (event->addr || event->size == 0) {
+					if (event->ptr) { live_remove(&live, event->ptr); }
+					if (event->addr) { live_insert(&live, event->addr, event->size); }
+				}
+				break;
+			case ALLOC_EVENT_FREE:
+				live_remove(&live, event->addr);
+				break;
+		}
+
+		if ((i + 1) % step == 0 || i == n - 1) {
+			double frag = event->heap_used ? 100.0 * (1.0 - (double)live.bytes / event->heap_used) : 0.0;
+			if (frag < 0) { frag = 0; }
+			printf("  %12.3f %12llu %12llu %7.1f%%\n", event->timestamp / 1e6,
+			       event->heap_used, live.bytes, frag);
+		}
+	}
+
+	free(live.slots);
+	free(events);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "mstats-alloc.h"
+
+/**
+ * Prints a summary of the events in the trace ring of `stats`:
+ * - a histogram of requested sizes,
+ * - p50/p99/max latency of each kind of call, and
+ * - heap used vs. live bytes (fragmentation) over the run.
+ */
+void trace_report(const alloc_stats_t *stats);
+
+// Saved traces start with this header, followed by `count` alloc_event_t in
+// the order the calls completed:
+#define TRACE_FILE_MAGIC "MSTRACE1"
+
+typedef struct _trace_file_header_t {
+    char magic[8];
+    unsigned long long count;
+} trace_file_header_t;
+
+/**
+ * Writes the completed events in the trace ring of `stats` to `path`.
+ * Returns the number of events written, or -1 on error.
+ */
+long trace_save(const alloc_stats_t *stats, const char *path);
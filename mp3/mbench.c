@@ -0,0 +1,282 @@
+/*
+ * Allocator benchmark driver.
+ *
+ * A workload is a trace of allocation calls recorded by `mstats`
+ * (MSTATS_TRACE/MSTATS_TRACE_FILE) from some program.  Each workload is
+ * replayed by `mreplay` against your alloc.so and against libc's malloc, for a
+ * number of iterations, and the two are reported side by side:
+ * - throughput, from `mreplay` run on its own (alloc.so via LD_PRELOAD),
+ * - peak/average heap, from `mreplay` run under `mstats`/`mstats-libc`, and
+ * - fragmentation, as peak heap over the peak bytes the trace holds live.
+ *
+ * Heap usage is how far the program break moved plus what the allocator
+ * mmap()s itself, so blocks your alloc.so maps count just like libc's (which
+ * mstats tells to keep everything on the program break).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#define DEFAULT_ITERATIONS 5
+#define DEFAULT_EVENTS (1 << 21)
+#define OUTPUT_SIZE 4096
+
+// Named workloads: the testers, recorded fresh on every run.
+typedef struct {
+	const char *name;
+	const char *program;
+} workload_t;
+
+static const workload_t workloads[] = {
+	{ "tester1", "tests/testers_exe/tester1" },
+	{ "tester2", "tests/testers_exe/tester2" },
+	{ "tester3", "tests/testers_exe/tester3" },
+	{ "tester4", "tests/testers_exe/tester4" },
+	{ "tester5", "tests/testers_exe/tester5" },
+	{ "tester6", "tests/testers_exe/tester6" },
+};
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+// Running mean/variance (Welford):
+typedef struct {
+	int n;
+	double mean;
+	double m2;
+} stat_t;
+
+static void stat_add(stat_t *s, double x) {
+	double delta = x - s->mean;
+	s->n++;
+	s->mean += delta / s->n;
+	s->m2 += delta * (x - s->mean);
+}
+
+static double stat_stddev(const stat_t *s) {
+	return (s->n > 1) ? sqrt(s->m2 / (s->n - 1)) : 0.0;
+}
+
+typedef struct {
+	stat_t mops;
+	stat_t max_heap;
+	stat_t avg_heap;
+	stat_t frag;
+} result_t;
+
+
+/*
+ * Runs `argv` with the `env` assignments ("NAME=value", or "NAME" to unset)
+ * applied.  If `out` is non-NULL, stdout is captured into a malloc'd string
+ * stored there; otherwise it is discarded.  Returns the exit status, or -1 if
+ * the program did not exit normally.
+ */
+static int run(char *const argv[], char *const env[], char **out) {
+	int fds[2];
+	if (pipe(fds) != 0) {
+		perror("pipe()");
+		exit(2);
+	}
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		for (int i = 0; env && env[i]; i++) {
+			if (strchr(env[i], '=')) { putenv(env[i]); }
+			else                     { unsetenv(env[i]); }
+		}
+		int null = open("/dev/null", O_WRONLY);
+		dup2(out ? fds[1] : null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+	close(fds[1]);
+
+	size_t len = 0, capacity = OUTPUT_SIZE;
+	char *buffer = malloc(capacity);
+	ssize_t got;
+	while ((got = read(fds[0], buffer + len, capacity - 1 - len)) > 0) {
+		if (!out) { continue; }
+		len += got;
+		if (capacity - 1 - len == 0) {
+			capacity *= 2;
+			buffer = realloc(buffer, capacity);
+		}
+	}
+	close(fds[0]);
+	buffer[len] = '\0';
+	if (out) { *out = buffer; }
+	else     { free(buffer); }
+
+	int status;
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) { return -1; }
+	return WEXITSTATUS(status);
+}
+
+// Finds `label` in `out` and reads the number after it.
+static double parse_value(const char *out, const char *label) {
+	const char *line = strstr(out, label);
+	return line ? atof(line + strlen(label)) : -1;
+}
+
+
+static int record(const char *trace, char *const argv[], long events) {
+	char trace_env[64], file_env[4096];
+	snprintf(trace_env, sizeof(trace_env), "MSTATS_TRACE=%ld", events);
+	snprintf(file_env, sizeof(file_env), "MSTATS_TRACE_FILE=%s", trace);
+	char *env[] = { trace_env, file_env, NULL };
+
+	int argc = 0;
+	while (argv[argc]) { argc++; }
+	char **mstats_argv = calloc(argc + 2, sizeof(char *));
+	mstats_argv[0] = "./mstats";
+	memcpy(mstats_argv + 1, argv, argc * sizeof(char *));
+
+	char *out;
+	int status = run(mstats_argv, env, &out);
+	free(mstats_argv);
+
+	int ok = (status == 0 && strstr(out, "[mstats]: STATUS: OK") && strstr(out, "[mstats]: TRACE SAVED"));
+	free(out);
+	if (!ok) {
+		fprintf(stderr, "[mbench]: recording `%s` failed.\n", argv[0]);
+		return -1;
+	}
+	return 0;
+}
+
+
+/*
+ * One iteration of `trace` against alloc.so (`libc` = 0) or libc (`libc` = 1).
+ */
+static int replay(const char *trace, int libc, result_t *result) {
+	char *out;
+	char *trace_arg = (char *)trace;
+
+	char *heap_argv[] = { libc ? "./mstats-libc" : "./mstats", "./mreplay", trace_arg, NULL };
+	char *heap_env[] = { "MSTATS_TRACE", NULL };
+	int status = run(heap_argv, heap_env, &out);
+	int ok = (status == 0 && strstr(out, "[mstats]: STATUS: OK"));
+	double max_heap = parse_value(out, "[mstats]: MAX: ");
+	double avg_heap = parse_value(out, "[mstats]: AVG: ");
+	free(out);
+	if (!ok) { return -1; }
+
+	char *speed_argv[] = { "./mreplay", trace_arg, NULL };
+	char *speed_env[] = { libc ? "LD_PRELOAD" : "LD_PRELOAD=./alloc.so", NULL };
+	status = run(speed_argv, speed_env, &out);
+	double ops = parse_value(out, "[mreplay]: OPS: ");
+	double time = parse_value(out, "[mreplay]: TIME: ");
+	double peak_live = parse_value(out, "[mreplay]: PEAK_LIVE: ");
+	free(out);
+	if (status != 0) { return -1; }
+
+	stat_add(&result->mops, time > 0 ? ops / time / 1e6 : 0);
+	stat_add(&result->max_heap, max_heap);
+	stat_add(&result->avg_heap, avg_heap);
+	stat_add(&result->frag, peak_live > 0 ? max_heap / peak_live : 0);
+	return 0;
+}
+
+
+static void bench(const char *name, const char *trace, int iterations) {
+	result_t results[2];
+	memset(results, 0, sizeof(results));
+
+	for (int i = 0; i < iterations; i++) {
+		for (int libc = 0; libc <= 1; libc++) {
+			if (replay(trace, libc, &results[libc]) != 0) {
+				printf("%-12s %-10s replay failed\n", name, libc ? "libc" : "alloc.so");
+				return;
+			}
+		}
+	}
+
+	for (int libc = 0; libc <= 1; libc++) {
+		const result_t *r = &results[libc];
+		printf("%-12s %-10s %9.2f ±%6.2f %12.0f ±%9.0f %12.0f ±%9.0f %8.2f ±%5.2f\n",
+		       name, libc ? "libc" : "alloc.so",
+		       r->mops.mean, stat_stddev(&r->mops),
+		       r->max_heap.mean, stat_stddev(&r->max_heap),
+		       r->avg_heap.mean, stat_stddev(&r->avg_heap),
+		       r->frag.mean, stat_stddev(&r->frag));
+	}
+}
+
+
+static void usage(const char *prog) {
+	printf("Usage: %s [-n iterations] [-e events] [workload ...]\n", prog);
+	printf("       %s record <trace-file> <program> [args ...]\n", prog);
+	printf("\n");
+	printf("A workload is the name of a tester or a trace file saved by `%s record`.\n", prog);
+	printf("With no workloads, every tester is benchmarked:\n ");
+	for (size_t i = 0; i < WORKLOAD_COUNT; i++) { printf(" %s", workloads[i].name); }
+	printf("\n");
+}
+
+
+int main(int argc, char **argv) {
+	int iterations = DEFAULT_ITERATIONS;
+	long events = DEFAULT_EVENTS;
+
+	if (argc >= 2 && strcmp(argv[1], "record") == 0) {
+		if (argc < 4) {
+			usage(argv[0]);
+			return 1;
+		}
+		return record(argv[2], argv + 3, events) == 0 ? 0 : 1;
+	}
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:e:h")) != -1) {
+		switch (opt) {
+			case 'n': iterations = atoi(optarg); break;
+			case 'e': events = atol(optarg); break;
+			default:
+				usage(argv[0]);
+				return opt != 'h';
+		}
+	}
+	if (iterations < 1 || events < 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	printf("%-12s %-10s %17s %24s %24s %15s\n", "workload", "allocator",
+	       "Mops/s", "peak heap", "avg heap", "frag");
+
+	int named = (optind == argc);
+	int count = named ? (int)WORKLOAD_COUNT : argc - optind;
+	for (int i = 0; i < count; i++) {
+		const char *arg = named ? workloads[i].name : argv[optind + i];
+		const workload_t *workload = NULL;
+		for (size_t w = 0; w < WORKLOAD_COUNT; w++) {
+			if (strcmp(arg, workloads[w].name) == 0) { workload = &workloads[w]; }
+		}
+
+		if (!workload) {
+			bench(arg, arg, iterations);
+			continue;
+		}
+
+		char trace[] = "/tmp/mbench-XXXXXX";
+		int fd = mkstemp(trace);
+		if (fd < 0) {
+			perror("mkstemp()");
+			return 2;
+		}
+		close(fd);
+
+		char *program_argv[] = { (char *)workload->program, NULL };
+		if (record(trace, program_argv, events) == 0) {
+			bench(workload->name, trace, iterations);
+		}
+		unlink(trace);
+	}
+
+	return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * Replays a trace saved by `mstats` (MSTATS_TRACE_FILE) against whichever
+ * malloc() the process is linked with, one call at a time in the recorded
+ * order.  Run it under `mstats`/`mstats-libc` for heap usage, or directly
+ * (optionally with LD_PRELOAD=./alloc.so) for throughput.
+ *
+ * All of the replayer's own tables are mmap()'d so that the only calls the
+ * allocator sees are the ones in the trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lib/mstats-trace.h"
+
+#define NO_SLOT 0xFFFFFFFFu
+
+/*
+ * A trace event with the recorded addresses replaced by slot numbers: each
+ * block allocated in the trace gets its own slot, which holds the pointer
+ * returned during the replay.
+ */
+typedef struct {
+	unsigned int type;   // ALLOC_EVENT_*, or 0 to skip.
+	unsigned int slot;   // Block returned (malloc/calloc/realloc) or freed.
+	unsigned int src;    // realloc: block passed in.
+	unsigned long long size;
+} op_t;
+
+typedef struct {
+	unsigned long long addr;
+	unsigned int slot;
+} addr_slot_t;
+
+
+static void *map_table(size_t size) {
+	void *table = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (table == MAP_FAILED) {
+		perror("mmap");
+		exit(2);
+	}
+	return table;
+}
+
+
+/*
+ * Recorded address -> slot of the block currently at that address, with
+ * linear probing and backward-shift deletion.
+ */
+static addr_slot_t *live;
+static size_t live_mask;
+
+static size_t live_hash(unsigned long long addr) {
+	return (size_t)((addr >> 4) * 0x9E3779B97F4A7C15ULL) & live_mask;
+}
+
+static void live_insert(unsigned long long addr, unsigned int slot) {
+	size_t i = live_hash(addr);
+	while (live[i].addr && live[i].addr != addr) { i = (i + 1) & live_mask; }
+	live[i].addr = addr;
+	live[i].slot = slot;
+}
+
+static unsigned int live_remove(unsigned long long addr) {
+	size_t i = live_hash(addr);
+	while (live[i].addr != addr) {
+		if (!live[i].addr) { return NO_SLOT; }  // Allocated before the trace started.
+		i = (i + 1) & live_mask;
+	}
+	unsigned int slot = live[i].slot;
+	live[i].addr = 0;
+
+	size_t hole = i;
+	for (i = (i + 1) & live_mask; live[i].addr; i = (i + 1) & live_mask) {
+		size_t home = live_hash(live[i].addr);
+		if (((i - home) & live_mask) >= ((i - hole) & live_mask)) {
+			live[hole] = live[i];
+			live[i].addr = 0;
+			hole = i;
+		}
+	}
+	return slot;
+}
+
+
+int main(int argc, char **argv) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <trace-file>\n", argv[0]);
+		return 1;
+	}
+
+	int fd = open(argv[1], O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	const trace_file_header_t *header = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED || (size_t)st.st_size < sizeof(trace_file_header_t) ||
+	    memcmp(header->magic, TRACE_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+	    sizeof(trace_file_header_t) + header->count * sizeof(alloc_event_t) > (size_t)st.st_size) {
+		fprintf(stderr, "%s: not a trace file\n", argv[1]);
+		return 1;
+	}
+	const alloc_event_t *events = (const alloc_event_t *)(header + 1);
+	size_t count = header->count;
+
+
+	/*
+	 * Turn the recorded addresses into slots (and work out the peak number of
+	 * bytes the program held, which the replay will hold too).
+	 */
+	op_t *ops = map_table((count + 1) * sizeof(op_t));
+	unsigned long long *sizes = map_table((count + 1) * sizeof(unsigned long long));
+	live_mask = 1;
+	while (live_mask < 2 * count) { live_mask <<= 1; }
+	live = map_table(live_mask * sizeof(addr_slot_t));
+	live_mask--;
+
+	unsigned int slots = 0;
+	unsigned long long live_bytes = 0, peak_live = 0;
+	for (size_t i = 0; i < count; i++) {
+		const alloc_event_t *event = &events[i];
+		op_t *op = &ops[i];
+		op->type = event->type;
+		op->slot = op->src = NO_SLOT;
+		op->size = event->size;
+
+		switch (event->type) {
+			case ALLOC_EVENT_MALLOC:
+			case ALLOC_EVENT_CALLOC:
+				if (!event->addr) { op->type = 0; break; }
+				op->slot = slots++;
+				break;
+			case ALLOC_EVENT_REALLOC:
+				// A failed realloc leaves the original block in place:
+				if (!event->addr && event->size) { op->type = 0; break; }
+				if (event->ptr) { op->src = live_remove(event->ptr); }
+				if (op->src != NO_SLOT) { live_bytes -= sizes[op->src]; }
+				if (event->addr) { op->slot = slots++; }
+				break;
+			case ALLOC_EVENT_FREE:
+				op->slot = live_remove(event->addr);
+				if (op->slot == NO_SLOT) { op->type = 0; break; }
+				live_bytes -= sizes[op->slot];
+				break;
+			default:
+				op->type = 0;
+				break;
+		}
+
+		if (op->type != ALLOC_EVENT_FREE && op->slot != NO_SLOT) {
+			live_insert(event->addr, op->slot);
+			sizes[op->slot] = event->size;
+			live_bytes += event->size;
+			if (live_bytes > peak_live) { peak_live = live_bytes; }
+		}
+	}
+	munmap(live, (live_mask + 1) * sizeof(addr_slot_t));
+	munmap(sizes, (count + 1) * sizeof(unsigned long long));
+
+
+	/*
+	 * Replay.
+	 */
+	void **ptrs = map_table((slots + 1) * sizeof(void *));
+	size_t replayed = 0;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (size_t i = 0; i < count; i++) {
+		const op_t *op = &ops[i];
+		void *ptr;
+		switch (op->type) {
+			case ALLOC_EVENT_MALLOC:
+				ptr = malloc(op->size);
+				if (ptr) { *(char *)ptr = 1; }
+				break;
+			case ALLOC_EVENT_CALLOC:
+				ptr = calloc(1, op->size);
+				break;
+			case ALLOC_EVENT_REALLOC:
+				ptr = realloc(op->src == NO_SLOT ? NULL : ptrs[op->src], op->size);
+				break;
+			case ALLOC_EVENT_FREE:
+				free(ptrs[op->slot]);
+				replayed++;
+				continue;
+			default:
+				continue;
+		}
+
+		if (op->slot != NO_SLOT) {
+			if (!ptr) {
+				fprintf(stderr, "Memory failed to allocate at event %zu!\n", i);
+				return 1;
+			}
+			ptrs[op->slot] = ptr;
+		}
+		replayed++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("[mreplay]: OPS: %zu\n", replayed);
+	printf("[mreplay]: TIME: %f\n", elapsed);
+	printf("[mreplay]: PEAK_LIVE: %llu\n", peak_live);
+	return 0;
+}
@@ -11,8 +11,13 @@
 #include <string.h>
 #include <sys/resource.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "lib/mstats-alloc.h"
+#include "lib/mstats-trace.h"
+
+// Default number of events kept when MSTATS_TRACE is set to 1:
+#define TRACE_DEFAULT_CAPACITY (1 << 20)
 
 int child_still_running = 1;
 
@@ -31,6 +36,52 @@ void *timeout_timer(void *ptr) {
 }
 
 
+/*
+ * Combines the stats of every process that ran under mstats: MAX is the
+ * largest heap any one process used, and AVG is over every allocator call.
+ */
+alloc_proc_stats_t stats_total(const alloc_stats_t *stats) {
+	alloc_proc_stats_t total;
+	memset(&total, 0, sizeof(total));
+
+	unsigned int count = stats->proc_count < ALLOC_STATS_PROCS ? stats->proc_count : ALLOC_STATS_PROCS;
+	for (unsigned int i = 0; i <= count; i++) {
+		const alloc_proc_stats_t *proc = (i < count) ? &stats->procs[i] : &stats->other_procs;
+		if (total.max_heap_used < proc->max_heap_used) { total.max_heap_used = proc->max_heap_used; }
+		total.memory_heap_sum += proc->memory_heap_sum;
+		total.memory_uses += proc->memory_uses;
+	}
+	return total;
+}
+
+double stats_avg(const alloc_proc_stats_t *proc) {
+	return proc->memory_uses ? proc->memory_heap_sum / (double)proc->memory_uses : 0;
+}
+
+// Prints one line per process, when the program started more than one:
+void stats_proc_report(const alloc_stats_t *stats) {
+	if (stats->proc_count <= 1) { return; }
+
+	unsigned int count = stats->proc_count < ALLOC_STATS_PROCS ? stats->proc_count : ALLOC_STATS_PROCS;
+	unsigned long long max_sum = 0;
+	printf("[mstats]: PROCESSES: %u\n", stats->proc_count);
+	printf("[mstats]:   %8s %8s  %-15s %12s %14s %10s\n", "PID", "PPID", "COMMAND", "MAX", "AVG", "CALLS");
+	for (unsigned int i = 0; i < count; i++) {
+		const alloc_proc_stats_t *proc = &stats->procs[i];
+		printf("[mstats]:   %8d %8d  %-15.15s %12llu %14.2f %10lu\n", proc->pid, proc->ppid, proc->command,
+		       proc->max_heap_used, stats_avg(proc), proc->memory_uses);
+		max_sum += proc->max_heap_used;
+	}
+	if (stats->proc_count > ALLOC_STATS_PROCS) {
+		const alloc_proc_stats_t *proc = &stats->other_procs;
+		printf("[mstats]:   %8s %8s  %-15s %12llu %14.2f %10lu\n", "-", "-", "(others)",
+		       proc->max_heap_used, stats_avg(proc), proc->memory_uses);
+		max_sum += proc->max_heap_used;
+	}
+	printf("[mstats]: SUM OF MAX: %llu\n", max_sum);
+}
+
+
 int main(int argc, char **argv, char **envp) {
 	/*
 	 * Check to ensure that the program is launched with at least one command
@@ -50,13 +101,34 @@ int main(int argc, char **argv, char **envp) {
 			evaluate = 1;
 	}
 	/*
-	 * Set up a shared memory file for later use by mmap(). 
+	 * Set up a shared memory file for later use by mmap().  With MSTATS_TRACE
+	 * set (to 1, or to the number of events to keep), the file also holds a
+	 * ring of allocation events that is summarized once the program exits
+	 * (and saved to MSTATS_TRACE_FILE, if set).
 	 */
+	unsigned long long trace_capacity = 0;
+	char *trace_env = getenv("MSTATS_TRACE");
+	if (trace_env) {
+		trace_capacity = strtoull(trace_env, NULL, 10);
+		if (trace_capacity == 1) { trace_capacity = TRACE_DEFAULT_CAPACITY; }
+	}
+	size_t stats_size = ALLOC_STATS_SIZE(trace_capacity);
+
 	char file_name[] = "/tmp/cs240-XXXXXX";
 	int fd = mkstemp(file_name);
 	
-	char *buffer = calloc(1, sizeof(alloc_stats_t));
+	alloc_stats_t *buffer = calloc(1, sizeof(alloc_stats_t));
+	if (trace_capacity) {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		buffer->trace_capacity = trace_capacity;
+		buffer->trace_epoch = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
 	write(fd, buffer, sizeof(alloc_stats_t));
+	if (ftruncate(fd, stats_size) != 0) {
+		perror("ftruncate()");
+		return 2;
+	}
 	close(fd);
 	free(buffer);
 
@@ -159,13 +231,14 @@ int main(int argc, char **argv, char **envp) {
 	pthread_detach(tid);
 	
 	FILE *file = fopen(file_name, "r");
-	alloc_stats_t *stats = mmap(NULL, sizeof(alloc_stats_t), PROT_READ, MAP_SHARED, fileno(file), 0);
-	if (!stats) {
+	alloc_stats_t *stats = mmap(NULL, stats_size, PROT_READ, MAP_SHARED, fileno(file), 0);
+	if (stats == MAP_FAILED) {
 		perror("mmap");
 		return 5;
 	}
 	
 	fclose(file);
+	alloc_proc_stats_t total = stats_total(stats);
 	
 	int total_sec = resources_used.ru_utime.tv_sec + resources_used.ru_stime.tv_sec;
 	int total_usec = resources_used.ru_utime.tv_usec + resources_used.ru_stime.tv_usec;
@@ -186,15 +259,15 @@ int main(int argc, char **argv, char **envp) {
 
 			// Save maximum memory used.
 			char max_heap_used[16];
-			sprintf(max_heap_used,"%llu\n",stats->max_heap_used);
+			sprintf(max_heap_used,"%llu\n",total.max_heap_used);
 			fputs(max_heap_used, result_file);
 
 			// Save average memory used.
-			if(stats->memory_uses == 0)
+			if(total.memory_uses == 0)
 				fputs("0\n", result_file);
 			else {
 				char avg_heap_used[32];
-				sprintf(avg_heap_used,"%.6f\n",stats->memory_heap_sum/(double)stats->memory_uses);
+				sprintf(avg_heap_used,"%.6f\n",stats_avg(&total));
 				fputs(avg_heap_used, result_file);
 			}
 			
@@ -212,14 +285,29 @@ int main(int argc, char **argv, char **envp) {
 
 	if (result == 0) { printf("[mstats]: STATUS: OK\n"); }
 	else             { printf("[mstats]: STATUS: FAILED=(%d)\n", result); }
-	printf("[mstats]: MAX: %llu\n", stats->max_heap_used);
-	
-	if (stats->memory_uses == 0) { printf("[mstats]: AVG: %f\n", 0.0f); }
-	else                         { printf("[mstats]: AVG: %f\n", (stats->memory_heap_sum / (double)stats->memory_uses)); }
-	
+	printf("[mstats]: MAX: %llu\n", total.max_heap_used);
+	printf("[mstats]: AVG: %f\n", stats_avg(&total));
 	printf("[mstats]: TIME: %f\n", total_time);
+	stats_proc_report(stats);
+
+	trace_report(stats);
+
+	// The heap profiler (MSTATS_PROFILE) writes its report from within the program:
+	char *profile = getenv("MSTATS_PROFILE");
+	if (profile && atol(profile) > 0) {
+		char *prefix = getenv("MSTATS_PROFILE_FILE");
+		printf("[mstats]: PROFILE: %s.%d.folded\n", (prefix && *prefix) ? prefix : "mstats-profile", forkid);
+	}
+
+	// Keep the raw events for replay (see mbench):
+	char *trace_file = getenv("MSTATS_TRACE_FILE");
+	if (trace_file && trace_capacity) {
+		long saved = trace_save(stats, trace_file);
+		if (saved < 0) { printf("[mstats]: ERROR SAVING TRACE TO %s\n", trace_file); }
+		else           { printf("[mstats]: TRACE SAVED: %ld events to %s\n", saved, trace_file); }
+	}
 
-	munmap(stats, sizeof(alloc_stats_t));
+	munmap(stats, stats_size);
 	unlink(file_name);
 	return 0;
 }
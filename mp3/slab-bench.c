@@ -0,0 +1,109 @@
+/**
+ * Compares slab_alloc()/slab_free() with malloc()/free() on fixed-size objects.
+ *
+ * Run it directly to compare against libc, or with LD_PRELOAD=./alloc.so to
+ * compare against your allocator.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "slab.h"
+
+#define BATCH 100000
+#define BATCH_ROUNDS 20
+#define LIVE 4096
+#define CHURN (2 * 1000 * 1000)
+
+static const size_t sizes[] = { 24, 48, 64, 200 };
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *objects[BATCH];
+
+/*
+ * Gets/puts one object through `pool`, or through malloc() if `pool` is NULL.
+ * Each object is written to so both paths touch the same memory.
+ */
+static void *get(slab_pool_t *pool, size_t size) {
+  char *ptr = pool ? slab_alloc(pool) : malloc(size);
+  if (!ptr) {
+    fprintf(stderr, "Memory failed to allocate!\n");
+    exit(1);
+  }
+  ptr[0] = ptr[size - 1] = (char)size;
+  return ptr;
+}
+
+static void put(slab_pool_t *pool, void *ptr, size_t size) {
+  if (((char *)ptr)[size - 1] != (char)size) {
+    fprintf(stderr, "Memory was corrupted!\n");
+    exit(2);
+  }
+  if (pool) {
+    slab_free(pool, ptr);
+  } else {
+    free(ptr);
+  }
+}
+
+// Allocate BATCH objects, then free them all.
+static double batch(slab_pool_t *pool, size_t size) {
+  double start = now();
+  for (int round = 0; round < BATCH_ROUNDS; round++) {
+    for (int i = 0; i < BATCH; i++) {
+      objects[i] = get(pool, size);
+    }
+    for (int i = 0; i < BATCH; i++) {
+      put(pool, objects[i], size);
+    }
+  }
+  return (now() - start) * 1e9 / (2.0 * BATCH * BATCH_ROUNDS);
+}
+
+// Keep LIVE objects alive and replace a pseudo-random one each step.
+static double churn(slab_pool_t *pool, size_t size) {
+  unsigned int seed = 240;
+  for (int i = 0; i < LIVE; i++) {
+    objects[i] = get(pool, size);
+  }
+
+  double start = now();
+  for (int i = 0; i < CHURN; i++) {
+    seed = seed * 1103515245 + 12345;
+    unsigned int victim = (seed >> 8) % LIVE;
+    put(pool, objects[victim], size);
+    objects[victim] = get(pool, size);
+  }
+  double elapsed = now() - start;
+
+  for (int i = 0; i < LIVE; i++) {
+    put(pool, objects[i], size);
+  }
+  return elapsed * 1e9 / (2.0 * CHURN);
+}
+
+int main() {
+  printf("%8s  %-8s %14s %14s %8s\n", "size", "workload", "malloc ns/op", "slab ns/op", "speedup");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    size_t size = sizes[s];
+
+    double mallocBatch = batch(NULL, size);
+    slab_pool_t *pool = slab_create(size);
+    double slabBatch = batch(pool, size);
+    slab_destroy(pool);
+    printf("%8zu  %-8s %14.2f %14.2f %7.2fx\n", size, "batch", mallocBatch, slabBatch, mallocBatch / slabBatch);
+
+    double mallocChurn = churn(NULL, size);
+    pool = slab_create(size);
+    double slabChurn = churn(pool, size);
+    slab_destroy(pool);
+    printf("%8zu  %-8s %14.2f %14.2f %7.2fx\n", size, "churn", mallocChurn, slabChurn, mallocChurn / slabChurn);
+  }
+  return 0;
+}
@@ -0,0 +1,127 @@
+/**
+ * Slab allocator
+ */
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "slab.h"
+
+#define OBJECT_ALIGNMENT 16
+// Slabs hold at least this many bytes of objects (and at least MIN_OBJECTS):
+#define SLAB_BYTES (64 * 1024)
+#define MIN_OBJECTS 16
+
+/*
+ * Each slab starts with a header, padded to a cache line, that links it into
+ * the pool's list of slabs.  The objects follow, starting on a cache line.
+ * `base` is what malloc() returned, since the slab itself is aligned up from
+ * it.
+ */
+typedef struct _slab_t {
+  struct _slab_t *next;
+  void *base;
+} slab_t;
+
+#define SLAB_HEADER ((sizeof(slab_t) + SLAB_CACHE_LINE - 1) & ~(size_t)(SLAB_CACHE_LINE - 1))
+
+// A free object; the link lives in the object's own memory.
+typedef struct _free_object_t {
+  struct _free_object_t *next;
+} free_object_t;
+
+struct _slab_pool_t {
+  size_t objectSize;
+  size_t slabObjects;     // Objects per slab.
+  free_object_t *free;    // Objects returned with slab_free().
+  char *bump;             // Next never-used object in the newest slab...
+  char *end;              // ...and the end of that slab.
+  slab_t *slabs;
+};
+
+
+/**
+ * Adds a new slab to `pool`; its objects are handed out from `bump`.
+ */
+static int growPool(slab_pool_t *pool) {
+  size_t bytes = SLAB_HEADER + pool->slabObjects * pool->objectSize;
+  void *base = malloc(bytes + SLAB_CACHE_LINE - 1);
+  if (!base) {
+    return 0;
+  }
+
+  uintptr_t aligned = ((uintptr_t)base + SLAB_CACHE_LINE - 1) & ~(uintptr_t)(SLAB_CACHE_LINE - 1);
+  slab_t *slab = (slab_t *)aligned;
+  slab->base = base;
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+
+  pool->bump = (char *)slab + SLAB_HEADER;
+  pool->end = pool->bump + pool->slabObjects * pool->objectSize;
+  return 1;
+}
+
+
+slab_pool_t *slab_create(size_t object_size) {
+  if (object_size < sizeof(free_object_t)) {
+    object_size = sizeof(free_object_t);
+  }
+  // A slab of MIN_OBJECTS objects, its header and its alignment slack must
+  // not overflow the size growPool() asks malloc() for:
+  if (object_size > (SIZE_MAX - SLAB_HEADER - SLAB_CACHE_LINE) / MIN_OBJECTS - OBJECT_ALIGNMENT) {
+    return NULL;
+  }
+
+  slab_pool_t *pool = malloc(sizeof(slab_pool_t));
+  if (!pool) {
+    return NULL;
+  }
+  pool->objectSize = (object_size + OBJECT_ALIGNMENT - 1) & ~(size_t)(OBJECT_ALIGNMENT - 1);
+  pool->slabObjects = SLAB_BYTES / pool->objectSize;
+  if (pool->slabObjects < MIN_OBJECTS) {
+    pool->slabObjects = MIN_OBJECTS;
+  }
+  pool->free = NULL;
+  pool->bump = pool->end = NULL;
+  pool->slabs = NULL;
+  return pool;
+}
+
+
+void *slab_alloc(slab_pool_t *pool) {
+  free_object_t *object = pool->free;
+  if (object) {
+    pool->free = object->next;
+    return object;
+  }
+
+  if (pool->bump == pool->end && !growPool(pool)) {
+    return NULL;
+  }
+  void *ptr = pool->bump;
+  pool->bump += pool->objectSize;
+  return ptr;
+}
+
+
+void slab_free(slab_pool_t *pool, void *ptr) {
+  if (!ptr) {
+    return;
+  }
+  free_object_t *object = ptr;
+  object->next = pool->free;
+  pool->free = object;
+}
+
+
+void slab_destroy(slab_pool_t *pool) {
+  if (!pool) {
+    return;
+  }
+  slab_t *slab = pool->slabs;
+  while (slab) {
+    slab_t *next = slab->next;
+    free(slab->base);
+    slab = next;
+  }
+  free(pool);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+
+#define SLAB_CACHE_LINE 64
+
+/**
+ * Object pool for fixed-size objects.
+ *
+ * Objects are carved from cache-line-aligned slabs obtained from malloc(), and
+ * freed objects are kept on a freelist threaded through the objects
+ * themselves, so slab_alloc() and slab_free() are O(1).  Memory is only
+ * returned to malloc() by slab_destroy().
+ *
+ * A pool is not thread-safe; use one pool per thread (or lock around it).
+ */
+typedef struct _slab_pool_t slab_pool_t;
+
+/**
+ * Creates a pool of objects of `object_size` bytes.  Every object is aligned
+ * to 16 bytes; pass a multiple of SLAB_CACHE_LINE to keep each object on its
+ * own cache lines.
+ *
+ * Returns NULL if the pool could not be allocated, or if `object_size` is so
+ * large that a slab of them would not fit in a size_t.
+ */
+slab_pool_t *slab_create(size_t object_size);
+
+/**
+ * Returns an uninitialized object from `pool`, or NULL if a new slab was
+ * needed and could not be allocated.
+ */
+void *slab_alloc(slab_pool_t *pool);
+
+/**
+ * Returns `ptr`, which must have come from slab_alloc() on the same `pool`,
+ * to the pool.  A NULL `ptr` is ignored.
+ */
+void slab_free(slab_pool_t *pool, void *ptr);
+
+/**
+ * Frees every slab of `pool` (and so every object ever allocated from it) and
+ * the pool itself.
+ */
+void slab_destroy(slab_pool_t *pool);
@@ -0,0 +1,81 @@
+#include "tester-utils.h"
+#include <malloc.h>
+#include <stdint.h>
+
+#define NUM_BLOCKS 64
+
+int aligned(void *ptr, size_t alignment) {
+    if (ptr == NULL) {
+        fprintf(stderr, "Memory failed to allocate!\n");
+        exit(1);
+    }
+    if ((uintptr_t)ptr % alignment != 0) {
+        fprintf(stderr, "Memory is not aligned to %zu bytes!\n", alignment);
+        exit(1);
+    }
+    return 1;
+}
+
+int main() {
+    void *blocks[NUM_BLOCKS];
+
+    // malloc() aligns for any type:
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        blocks[i] = malloc(i + 2);
+        aligned(blocks[i], 16);
+        verify_write(blocks[i], i + 2);
+    }
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        if (!verify_read(blocks[i], i + 2)) {
+            return 1;
+        }
+        if (malloc_usable_size(blocks[i]) < (size_t)(i + 2)) {
+            fprintf(stderr, "malloc_usable_size() is too small!\n");
+            return 1;
+        }
+        free(blocks[i]);
+    }
+
+    // Every power of two from 16 bytes to a page, mixed with small blocks:
+    for (size_t alignment = 16; alignment <= 4 * K; alignment *= 2) {
+        for (int i = 0; i < NUM_BLOCKS; i++) {
+            size_t size = 24 + i * 40;
+            if (i % 2) {
+                blocks[i] = malloc(size);
+            } else if (posix_memalign(&blocks[i], alignment, size) != 0) {
+                blocks[i] = NULL;
+            }
+            aligned(blocks[i], (i % 2) ? 16 : alignment);
+            verify_write(blocks[i], size);
+        }
+        for (int i = 0; i < NUM_BLOCKS; i++) {
+            if (!verify_read(blocks[i], 24 + i * 40)) {
+                return 1;
+            }
+            free(blocks[i]);
+        }
+    }
+
+    void *ptr = aligned_alloc(64, 1000);
+    aligned(ptr, 64);
+    verify_write(ptr, 1000);
+    ptr = realloc(ptr, 5000);
+    if (!verify_read(ptr, 1000)) {
+        return 1;
+    }
+    free(ptr);
+
+    // Large blocks get their own mapping:
+    ptr = memalign(64 * K, 1 * M);
+    aligned(ptr, 64 * K);
+    verify_write(ptr, 1 * M);
+    free(ptr);
+
+    if (posix_memalign(&ptr, 3, 16) == 0) {
+        fprintf(stderr, "posix_memalign() accepted an invalid alignment!\n");
+        return 1;
+    }
+
+    fprintf(stderr, "Memory was allocated, used, and freed!\n");
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include "tester-utils.h"
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+
+// Past what a 32-bit block size can hold; only touched at a few spots, so
+// the pages are never all backed at once.
+#define HUGE_SIZE ((size_t)5 * G)
+
+void check(void *ptr, const char *what) {
+    if (ptr == NULL) {
+        fprintf(stderr, "%s failed to allocate!\n", what);
+        exit(1);
+    }
+}
+
+void check_failed(void *ptr, const char *what) {
+    if (ptr != NULL || errno != ENOMEM) {
+        fprintf(stderr, "%s did not fail with ENOMEM!\n", what);
+        exit(1);
+    }
+}
+
+int main() {
+    char *ptr = malloc(HUGE_SIZE);
+    check(ptr, "malloc()");
+    if (malloc_usable_size(ptr) < HUGE_SIZE) {
+        fprintf(stderr, "malloc_usable_size() is too small!\n");
+        return 1;
+    }
+    verify_write(ptr, HUGE_SIZE);
+
+    ptr = realloc(ptr, HUGE_SIZE + G);
+    check(ptr, "realloc()");
+    if (!verify_read(ptr, HUGE_SIZE)) {
+        return 1;
+    }
+    free(ptr);
+
+    ptr = calloc(HUGE_SIZE / 8, 8);
+    check(ptr, "calloc()");
+    verify(ptr + HUGE_SIZE - 4 * K, 0, 4 * K);
+    free(ptr);
+
+    void *aligned = NULL;
+    if (posix_memalign(&aligned, M, HUGE_SIZE) != 0 || (uintptr_t)aligned % M != 0) {
+        fprintf(stderr, "posix_memalign() failed!\n");
+        return 1;
+    }
+    free(aligned);
+
+    // Requests that cannot be met set errno:
+    errno = 0;
+    check_failed(malloc(SIZE_MAX - 4 * K), "malloc(SIZE_MAX - 4K)");
+    errno = 0;
+    check_failed(calloc(SIZE_MAX / 2, 4), "calloc() of an overflowing size");
+    ptr = malloc(16);
+    errno = 0;
+    check_failed(realloc(ptr, SIZE_MAX / 2), "realloc(SIZE_MAX / 2)");
+    free(ptr);
+
+    fprintf(stderr, "Memory was allocated, used, and freed!\n");
+    return 0;
+}
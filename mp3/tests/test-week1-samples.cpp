@@ -124,3 +124,22 @@ TEST_CASE("10-free-lists - Free Lists", "[weight=25][part=4]") {
   REQUIRE(result->time_taken < 3);
   system("rm mstats_result.txt");
 }
+
+// ALIGNED ALLOCATION
+TEST_CASE("11-aligned - malloc aligns to 16 bytes, posix_memalign and friends to any power of two", "[weight=5][part=4]") {
+  system("make -s");
+  system("./mstats tests/samples_exe/11-aligned evaluate");
+  mstats_result * result = read_mstats_result("mstats_result.txt");
+  REQUIRE(result->status == 1);
+  // 0x40000 for the small blocks, and the mapped 1 MB block:
+  REQUIRE(result->max_heap_used < 0x40000 + 0x110000);
+  REQUIRE(result->max_heap_used > 0);
+  system("rm mstats_result.txt");
+}
+
+// LARGE REQUESTS
+// Run without mstats, whose heap limit is below the 5 GB these blocks take.
+TEST_CASE("12-large-requests - blocks past 4 GB are mapped, and failed requests set errno", "[weight=5][part=4]") {
+  system("make -s");
+  REQUIRE(system("LD_PRELOAD=./alloc.so tests/samples_exe/12-large-requests") == 0);
+}
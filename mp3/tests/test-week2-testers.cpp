@@ -60,3 +60,41 @@ TEST_CASE("tester5", "[weight=20][part=5][suite=week2][timeout=30]") {
   system("rm mstats_result.txt");
   REQUIRE(result->status == 1);
 }
+
+TEST_CASE("tester6 - multithreaded", "[weight=20][part=5][suite=week2][timeout=30]") {
+  system("make -s");
+  system("./mstats tests/testers_exe/tester6 evaluate");
+  mstats_result * result = read_mstats_result("mstats_result.txt");
+  system("rm mstats_result.txt");
+  REQUIRE(result->status == 1);
+}
+
+TEST_CASE("tester7 - slab allocator", "[weight=10][part=5][suite=week2][timeout=30]") {
+  system("make -s");
+  system("./mstats tests/testers_exe/tester7 evaluate");
+  mstats_result * result = read_mstats_result("mstats_result.txt");
+  system("rm mstats_result.txt");
+  REQUIRE(result->status == 1);
+}
+
+TEST_CASE("tester8 - calloc zeroes split blocks on every arena", "[weight=10][part=5][suite=week2][timeout=30]") {
+  system("make -s");
+  system("./mstats tests/testers_exe/tester8 evaluate");
+  mstats_result * result = read_mstats_result("mstats_result.txt");
+  system("rm mstats_result.txt");
+  REQUIRE(result->status == 1);
+}
+
+// Run without mstats, whose heap limit is below the 4.8 GB these blocks take.
+TEST_CASE("tester9 - free blocks past 4 GB", "[weight=10][part=5][suite=week2][timeout=60]") {
+  system("make -s");
+  REQUIRE(system("LD_PRELOAD=./alloc.so tests/testers_exe/tester9") == 0);
+}
+
+TEST_CASE("tester10 - free ignores what the program left in a block", "[weight=10][part=5][suite=week2][timeout=30]") {
+  system("make -s");
+  system("./mstats tests/testers_exe/tester10 evaluate");
+  mstats_result * result = read_mstats_result("mstats_result.txt");
+  system("rm mstats_result.txt");
+  REQUIRE(result->status == 1);
+}
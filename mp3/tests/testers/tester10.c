@@ -0,0 +1,72 @@
+#include "tester-utils.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#define NUM_ROUNDS 1000
+
+/*
+ * Whatever the program leaves in a block is its own business: free() must
+ * never mistake it for the allocator's bookkeeping.  Every block here is
+ * freed with its first words set to values that look like a link between
+ * freed blocks (pointers into the heap, XORed with a fixed key as some
+ * allocators store them) or to zero, from its own thread and from another.
+ */
+static const uint64_t keys[] = { 0, 0xCAC4ED0B10C4ED00ULL, 0xFFFFFFFFFFFFFFFFULL };
+static const size_t sizes[] = { 1, 24, 32, 64, 100, 1000, 5000 };
+
+#define NUM_KEYS (sizeof(keys) / sizeof(keys[0]))
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+char *pending[NUM_ROUNDS];
+
+// Fills the first words of `ptr` with `key` XORed with addresses near `other`.
+void disguise(char *ptr, size_t size, char *other, uint64_t key, int round) {
+    uint64_t word = key ^ (uintptr_t)(other - 8 * (round % 5));
+    memcpy(ptr, &word, MIN(size, sizeof(word)));
+    if (size >= 2 * sizeof(word)) {
+        memcpy(ptr + sizeof(word), &word, sizeof(word));
+    }
+}
+
+char *allocate(int round) {
+    size_t size = sizes[round % NUM_SIZES];
+    char *ptr = malloc(size);
+    char *other = malloc(size);
+    if (ptr == NULL || other == NULL) {
+        fprintf(stderr, "Memory failed to allocate!\n");
+        exit(1);
+    }
+    disguise(ptr, size, other, keys[round % NUM_KEYS], round);
+    disguise(other, size, ptr, keys[(round + 1) % NUM_KEYS], round);
+    free(other);
+    return ptr;
+}
+
+void *free_pending(void *arg) {
+    int round;
+    (void)arg;
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        free(pending[round]);
+    }
+    return NULL;
+}
+
+int main() {
+    pthread_t tid;
+    int round;
+
+    // Freed by the thread that allocated them:
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        free(allocate(round));
+    }
+
+    // Freed by another thread:
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        pending[round] = allocate(round);
+    }
+    pthread_create(&tid, NULL, free_pending, NULL);
+    pthread_join(tid, NULL);
+
+    fprintf(stderr, "Memory was allocated, used, and freed!\n");
+    return 0;
+}
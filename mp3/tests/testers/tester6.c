@@ -0,0 +1,109 @@
+#include "tester-utils.h"
+#include <pthread.h>
+
+#define MAX_THREADS 8
+#define NUM_ROUNDS 200
+#define BATCH_SIZE 256
+#define LOCAL_CYCLES 2000
+
+/*
+ * Each round, every thread:
+ * - runs LOCAL_CYCLES malloc/free pairs of small sizes on its own, then
+ * - allocates BATCH_SIZE blocks into its outbox and, once every thread has
+ *   done the same, frees the blocks in its neighbour's outbox.
+ *
+ * The second half makes every free in it a cross-thread free.
+ */
+typedef struct {
+    int id;
+    int num_threads;
+    long ops;
+} worker_t;
+
+char *outbox[MAX_THREADS][BATCH_SIZE];
+pthread_barrier_t barrier;
+
+size_t block_size(int id, int i) {
+    return 8 + ((id * 31 + i * 17) % 120);
+}
+
+void *worker(void *arg) {
+    worker_t *w = arg;
+    int round, i;
+
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        for (i = 0; i < LOCAL_CYCLES; i++) {
+            size_t len = block_size(w->id, i);
+            char *ptr = malloc(len);
+            if (ptr == NULL) {
+                fprintf(stderr, "Memory failed to allocate!\n");
+                exit(1);
+            }
+            verify_write(ptr, len);
+            if (!verify_read(ptr, len)) {
+                exit(2);
+            }
+            free(ptr);
+        }
+
+        for (i = 0; i < BATCH_SIZE; i++) {
+            size_t len = block_size(w->id, i);
+            outbox[w->id][i] = malloc(len);
+            if (outbox[w->id][i] == NULL) {
+                fprintf(stderr, "Memory failed to allocate!\n");
+                exit(1);
+            }
+            memset(outbox[w->id][i], w->id, len);
+        }
+        pthread_barrier_wait(&barrier);
+
+        int from = (w->id + 1) % w->num_threads;
+        for (i = 0; i < BATCH_SIZE; i++) {
+            verify(outbox[from][i], from, block_size(from, i));
+            free(outbox[from][i]);
+        }
+        pthread_barrier_wait(&barrier);
+
+        w->ops += 2 * (LOCAL_CYCLES + BATCH_SIZE);
+    }
+
+    return NULL;
+}
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main() {
+    int num_threads;
+    for (num_threads = 1; num_threads <= MAX_THREADS; num_threads *= 2) {
+        pthread_t tids[MAX_THREADS];
+        worker_t workers[MAX_THREADS];
+        int i;
+
+        pthread_barrier_init(&barrier, NULL, num_threads);
+        double start = now();
+        for (i = 0; i < num_threads; i++) {
+            workers[i].id = i;
+            workers[i].num_threads = num_threads;
+            workers[i].ops = 0;
+            pthread_create(&tids[i], NULL, worker, &workers[i]);
+        }
+
+        long ops = 0;
+        for (i = 0; i < num_threads; i++) {
+            pthread_join(tids[i], NULL);
+            ops += workers[i].ops;
+        }
+        double elapsed = now() - start;
+        pthread_barrier_destroy(&barrier);
+
+        fprintf(stderr, "%d thread(s): %ld ops in %.3fs (%.2f Mops/s)\n",
+                num_threads, ops, elapsed, ops / elapsed / 1e6);
+    }
+
+    fprintf(stderr, "Memory was allocated, used, and freed by all threads!\n");
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "tester-utils.h"
+#include <stdint.h>
+#include "../../slab.h"
+
+#define NUM_OBJECTS 10000
+#define NUM_REUSED 100
+
+/*
+ * Exercises the slab allocator (slab.c) on top of your malloc():
+ * - objects from several slabs are distinct and 16-byte aligned,
+ * - freed objects are handed out again before any new memory,
+ * - destroying a pool with objects still in use frees them all, and
+ * - object sizes whose slabs would not fit in a size_t are rejected.
+ */
+void *objects[NUM_OBJECTS];
+
+int compare_pointers(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(void **)a, y = (uintptr_t)*(void **)b;
+    return (x > y) - (x < y);
+}
+
+void fill_pool(slab_pool_t *pool, size_t size) {
+    int i;
+    for (i = 0; i < NUM_OBJECTS; i++) {
+        objects[i] = slab_alloc(pool);
+        if (objects[i] == NULL) {
+            fprintf(stderr, "Memory failed to allocate!\n");
+            exit(1);
+        }
+        if ((uintptr_t)objects[i] % 16 != 0) {
+            fprintf(stderr, "Object is not aligned to 16 bytes!\n");
+            exit(1);
+        }
+        memset(objects[i], i & 0xFF, size);
+    }
+    for (i = 0; i < NUM_OBJECTS; i++) {
+        verify(objects[i], i & 0xFF, size);
+    }
+}
+
+void check_distinct(size_t size) {
+    void *sorted[NUM_OBJECTS];
+    int i;
+    memcpy(sorted, objects, sizeof(sorted));
+    qsort(sorted, NUM_OBJECTS, sizeof(void *), compare_pointers);
+    for (i = 1; i < NUM_OBJECTS; i++) {
+        verify_overlap2(sorted[i - 1], sorted[i], size);
+    }
+}
+
+void check_reuse(slab_pool_t *pool) {
+    void *freed[NUM_REUSED];
+    int i, j;
+    for (i = 0; i < NUM_REUSED; i++) {
+        freed[i] = objects[i * (NUM_OBJECTS / NUM_REUSED)];
+        slab_free(pool, freed[i]);
+    }
+    slab_free(pool, NULL);
+
+    for (i = 0; i < NUM_REUSED; i++) {
+        void *ptr = slab_alloc(pool);
+        for (j = 0; j < NUM_REUSED && freed[j] != ptr; j++) { }
+        if (j == NUM_REUSED) {
+            fprintf(stderr, "slab_alloc() did not reuse a freed object!\n");
+            exit(1);
+        }
+        freed[j] = NULL;
+    }
+}
+
+int main() {
+    static const size_t sizes[] = { 1, 24, 64, 200, 4000 };
+    int i;
+
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+        slab_pool_t *pool = slab_create(sizes[i]);
+        if (pool == NULL) {
+            fprintf(stderr, "slab_create() failed!\n");
+            return 1;
+        }
+        fill_pool(pool, sizes[i]);
+        check_distinct(sizes[i]);
+        check_reuse(pool);
+        // Every object is still in use:
+        slab_destroy(pool);
+    }
+    slab_destroy(NULL);
+
+    if (slab_create(SIZE_MAX) != NULL || slab_create(SIZE_MAX / 2) != NULL ||
+        slab_create(SIZE_MAX / 16) != NULL) {
+        fprintf(stderr, "slab_create() accepted an object size too large for a slab!\n");
+        return 1;
+    }
+
+    fprintf(stderr, "Memory was allocated, used, and freed!\n");
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "tester-utils.h"
+#include <pthread.h>
+
+#define NUM_ROUNDS 200
+
+/*
+ * calloc() skips zeroing memory it knows is fresh from the kernel.  The free
+ * remainder of a split block is not fresh, though: it holds its bin links.
+ * On a secondary arena (any thread but the first), which grows in large
+ * steps, a remainder often sits right where the fresh memory starts, so
+ * calloc() has to zero those links when the remainder is handed out.
+ */
+void check_zero(char *ptr, size_t len) {
+    if (ptr == NULL) {
+        fprintf(stderr, "Memory failed to allocate!\n");
+        exit(1);
+    }
+    verify(ptr, 0x00, len);
+}
+
+void *worker(void *arg) {
+    int round;
+    (void)arg;
+
+    // A freed block and a split remainder in the same bin:
+    char *a = malloc(18000);
+    char *b = malloc(100);
+    char *c = malloc(24000);
+    verify_write(a, 18000);
+    free(a);
+    char *d = calloc(1, 20000);
+    check_zero(d, 20000);
+    free(b);
+    free(c);
+    free(d);
+
+    // The same with the remainder in other bins:
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        size_t first = 512 + (round * 97) % 8192;
+        size_t len = first + (round * 31) % 2048;
+        char *e = malloc(first);
+        char *f = malloc(24);
+        memset(e, 0xFF, first);
+        free(e);
+        char *g = calloc(len, 1);
+        check_zero(g, len);
+        memset(g, 0xFF, len);
+        free(f);
+        free(g);
+    }
+    return NULL;
+}
+
+int main() {
+    pthread_t tid;
+
+    // The first thread's arena:
+    worker(NULL);
+
+    // A secondary arena:
+    pthread_create(&tid, NULL, worker, NULL);
+    pthread_join(tid, NULL);
+
+    fprintf(stderr, "Memory was allocated, used, and freed!\n");
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include "tester-utils.h"
+#include <stdint.h>
+#include <unistd.h>
+
+#define NUM_BLOCKS 40000
+#define BLOCK_SIZE (120 * K)
+
+/*
+ * Frees a heap of more than 4 GB, block by block, so free blocks keep
+ * merging past what a block's 32-bit size can hold, then allocates the same
+ * blocks again: they have to fit in the heap that is already there, without
+ * overlapping.  Only the allocator's own headers are written, so most pages
+ * are never backed.
+ */
+char *blocks[NUM_BLOCKS];
+
+int compare_pointers(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(char **)a, y = (uintptr_t)*(char **)b;
+    return (x > y) - (x < y);
+}
+
+void allocate_all() {
+    int i;
+    for (i = 0; i < NUM_BLOCKS; i++) {
+        blocks[i] = malloc(BLOCK_SIZE);
+        if (blocks[i] == NULL) {
+            fprintf(stderr, "Memory failed to allocate!\n");
+            exit(1);
+        }
+    }
+}
+
+int main() {
+    char *heap_start = sbrk(0);
+    int i;
+
+    allocate_all();
+    char *heap_end = sbrk(0);
+    for (i = 0; i < NUM_BLOCKS; i++) {
+        free(blocks[i]);
+    }
+
+    allocate_all();
+    if ((char *)sbrk(0) > heap_end) {
+        fprintf(stderr, "Freed memory was not reused!\n");
+        return 1;
+    }
+    qsort(blocks, NUM_BLOCKS, sizeof(char *), compare_pointers);
+    for (i = 0; i < NUM_BLOCKS; i++) {
+        if (blocks[i] < heap_start || blocks[i] + BLOCK_SIZE > heap_end) {
+            fprintf(stderr, "Block is outside of the heap!\n");
+            return 1;
+        }
+        if (i > 0) {
+            verify_overlap2(blocks[i - 1], blocks[i], BLOCK_SIZE);
+        }
+    }
+
+    char *small = malloc(100);
+    verify_write(small, 100);
+    if (!verify_read(small, 100)) {
+        return 2;
+    }
+    free(small);
+    for (i = 0; i < NUM_BLOCKS; i++) {
+        free(blocks[i]);
+    }
+
+    fprintf(stderr, "Memory was allocated, used, and freed!\n");
+    return 0;
+}